@@ -0,0 +1,85 @@
+//! Benchmarks parameter set, SEI, and slice header parsing with the iterator-backed and
+//! slice-backed bitstream readers.
+//!
+//! Runs against the SMPTE bars test stream and a copy of [Big Buck Bunny](https://peach.blender.org/download/):
+//! ```text
+//! $ curl -OL https://download.blender.org/peach/bigbuckbunny_movies/big_buck_bunny_1080p_h264.mov
+//! $ ffmpeg -i big_buck_bunny_1080p_h264.mov -c copy big_buck_bunny_1080p.h264
+//! ```
+
+use criterion::{criterion_group, criterion_main, Criterion};
+use h264::{Bitstream, Decode, PicTiming, RBSPIter, SequenceParameterSet, SliceHeader, NAL_UNIT_TYPE_MASK, RBSP, SEI};
+use std::{iter::Copied, slice::Iter};
+
+fn iterator_bitstream(payload: &[u8]) -> Bitstream<RBSPIter<Copied<Iter<'_, u8>>>> {
+    Bitstream::new(RBSP::new(payload.iter().copied()))
+}
+
+// Decodes every SPS, SEI (including pic timing), and slice header in `nalus`, constructing each
+// RBSP bitstream from the NAL unit payload with `$bitstream`. SEI payloads have already had their
+// emulation prevention removed, so pic timing is always decoded from an iterator. Returns the
+// number of decoded syntax structures.
+macro_rules! parse_nalus {
+    ($nalus:expr, $bitstream:expr) => {{
+        let mut sps = None;
+        let mut decoded = 0;
+        for nalu in $nalus {
+            let payload = &nalu[1..];
+            match nalu[0] & NAL_UNIT_TYPE_MASK {
+                1 | 5 => {
+                    if let Some(sps) = &sps {
+                        SliceHeader::decode(&mut $bitstream(payload), sps).unwrap();
+                        decoded += 1;
+                    }
+                }
+                6 => {
+                    let sei = SEI::decode(&mut $bitstream(payload)).unwrap();
+                    decoded += 1;
+                    if let Some(sps) = &sps {
+                        for message in sei.sei_message.iter().filter(|m| m.payload_type == 1) {
+                            PicTiming::decode(&mut Bitstream::new(message.payload.iter().copied()), &sps.vui_parameters).unwrap();
+                            decoded += 1;
+                        }
+                    }
+                }
+                7 => {
+                    sps = Some(SequenceParameterSet::decode(&mut $bitstream(payload)).unwrap());
+                    decoded += 1;
+                }
+                _ => {}
+            }
+        }
+        decoded
+    }};
+}
+
+fn criterion_benchmark(c: &mut Criterion) {
+    for (name, path) in [
+        ("big_buck_bunny_1080p", "benches/testdata/big_buck_bunny_1080p.h264"),
+        ("smptebars", "../xilinx/src/testdata/smptebars.h264"),
+    ] {
+        let buf = std::fs::read(path).unwrap();
+        let nalus = h264::iterate_annex_b(&buf).filter(|nalu| !nalu.is_empty()).collect::<Vec<_>>();
+        let expected = parse_nalus!(&nalus, iterator_bitstream);
+
+        let mut g = c.benchmark_group(format!("bitstream/{}", name));
+        g.throughput(criterion::Throughput::Elements(expected as u64));
+        g.bench_function("iterator", |b| {
+            b.iter(|| {
+                assert_eq!(parse_nalus!(&nalus, iterator_bitstream), expected);
+            });
+        });
+        g.bench_function("slice", |b| {
+            b.iter(|| {
+                assert_eq!(parse_nalus!(&nalus, Bitstream::from_slice), expected);
+            });
+        });
+        g.warm_up_time(std::time::Duration::from_secs(1));
+        g.sampling_mode(criterion::SamplingMode::Flat);
+        g.sample_size(10);
+        g.finish();
+    }
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
@@ -1,4 +1,4 @@
-//! Benchmarks iteration over Annex B NALs.
+//! Benchmarks iteration over Annex B NALs, both in memory and read from a stream.
 //!
 //! Expects a copy of [Big Buck Bunny](https://peach.blender.org/download/):
 //! ```text
@@ -17,6 +17,11 @@ fn criterion_benchmark(c: &mut Criterion) {
             assert_eq!(h264::iterate_annex_b(&buf).count(), 130030);
         });
     });
+    g.bench_function("read_annex_b", |b| {
+        b.iter(|| {
+            assert_eq!(h264::read_annex_b(&buf[..]).map(|nalu| nalu.unwrap()).count(), 130030);
+        });
+    });
     g.warm_up_time(std::time::Duration::from_secs(1));
     g.sampling_mode(criterion::SamplingMode::Flat);
     g.sample_size(10);
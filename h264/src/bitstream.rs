@@ -1,4 +1,159 @@
-use std::io;
+use std::{convert::TryInto, io};
+
+/// A source of RBSP bytes for a [`Bitstream`].
+///
+/// Every `Iterator<Item = u8>` is a source, which makes the bitstream pull one byte at a time. Sources
+/// backed by contiguous memory, such as [`RBSPSlice`], can also hand out whole words and skip or copy
+/// bytes in bulk.
+pub trait BitstreamSource {
+    fn next_byte(&mut self) -> Option<u8>;
+
+    /// Returns up to 8 bytes packed into the least significant bits of a `u64` along with the number
+    /// of bytes. Returns `None` if the source is exhausted or does not support reading whole words.
+    fn next_word(&mut self) -> Option<(u64, usize)> {
+        None
+    }
+
+    /// Skips up to `n` bytes, returning the number of bytes actually skipped.
+    fn skip_bytes(&mut self, n: usize) -> usize {
+        (0..n).take_while(|_| self.next_byte().is_some()).count()
+    }
+
+    /// Appends up to `n` bytes to `buf`.
+    fn read_bytes_into(&mut self, n: usize, buf: &mut Vec<u8>) {
+        buf.extend(std::iter::from_fn(|| self.next_byte()).take(n));
+    }
+}
+
+impl<T: Iterator<Item = u8>> BitstreamSource for T {
+    fn next_byte(&mut self) -> Option<u8> {
+        self.next()
+    }
+}
+
+/// Reads RBSP bytes directly out of an in-memory NAL unit payload, removing emulation prevention
+/// bytes as it goes.
+///
+/// This is equivalent to iterating over `RBSP::new(buf.iter().copied())`, but bytes are read a word
+/// at a time and emulation prevention bytes are located with memchr when copying or skipping.
+#[derive(Clone, Debug)]
+pub struct RBSPSlice<'a> {
+    buf: &'a [u8],
+    pos: usize,
+    // the earliest position at which a 00 00 03 sequence can begin, i.e. just after the last
+    // emulation prevention byte
+    sequence_start: usize,
+}
+
+impl<'a> RBSPSlice<'a> {
+    pub fn new(buf: &'a [u8]) -> Self {
+        Self {
+            buf,
+            pos: 0,
+            sequence_start: 0,
+        }
+    }
+
+    // Returns true if the 03 byte at `idx` is an emulation prevention byte.
+    fn is_emulation_prevention_byte(&self, idx: usize) -> bool {
+        idx >= self.sequence_start + 2 && self.buf[idx - 1] == 0 && self.buf[idx - 2] == 0
+    }
+
+    fn skip_emulation_prevention_byte(&mut self) {
+        self.pos += 1;
+        self.sequence_start = self.pos;
+    }
+
+    // Consumes up to n bytes, stopping early at emulation prevention bytes, and returns them.
+    fn next_run(&mut self, n: usize) -> &'a [u8] {
+        loop {
+            let end = self.buf.len().min(self.pos + n);
+            let run = match memchr::memchr(3, &self.buf[self.pos..end]) {
+                Some(idx) if self.is_emulation_prevention_byte(self.pos + idx) => {
+                    if idx == 0 {
+                        self.skip_emulation_prevention_byte();
+                        continue;
+                    }
+                    &self.buf[self.pos..self.pos + idx]
+                }
+                Some(idx) => &self.buf[self.pos..self.pos + idx + 1],
+                None => &self.buf[self.pos..end],
+            };
+            self.pos += run.len();
+            return run;
+        }
+    }
+}
+
+impl<'a> BitstreamSource for RBSPSlice<'a> {
+    fn next_byte(&mut self) -> Option<u8> {
+        loop {
+            let b = *self.buf.get(self.pos)?;
+            if b == 3 && self.is_emulation_prevention_byte(self.pos) {
+                self.skip_emulation_prevention_byte();
+                continue;
+            }
+            self.pos += 1;
+            return Some(b);
+        }
+    }
+
+    fn next_word(&mut self) -> Option<(u64, usize)> {
+        let len = self.buf.len().saturating_sub(self.pos).min(8);
+        if len == 0 {
+            return None;
+        }
+        let word = match self.buf.get(self.pos..self.pos + 8) {
+            Some(bytes) => u64::from_be_bytes(bytes.try_into().expect("slice is 8 bytes")),
+            None => self.buf[self.pos..].iter().fold(0, |word, &b| word << 8 | b as u64) << ((8 - len) * 8),
+        };
+        // emulation prevention bytes are rare, so only fall back to reading byte by byte if there's
+        // a 03 byte somewhere in the word
+        let x = word ^ 0x0303_0303_0303_0303;
+        if x.wrapping_sub(0x0101_0101_0101_0101) & !x & 0x8080_8080_8080_8080 == 0 {
+            self.pos += len;
+            return Some((word >> ((8 - len) * 8), len));
+        }
+
+        let mut word = 0;
+        let mut len = 0;
+        while len < 8 {
+            match self.next_byte() {
+                Some(b) => word = word << 8 | b as u64,
+                None => break,
+            }
+            len += 1;
+        }
+        match len {
+            0 => None,
+            _ => Some((word, len)),
+        }
+    }
+
+    fn skip_bytes(&mut self, n: usize) -> usize {
+        let mut skipped = 0;
+        while skipped < n {
+            let run = self.next_run(n - skipped);
+            if run.is_empty() {
+                break;
+            }
+            skipped += run.len();
+        }
+        skipped
+    }
+
+    fn read_bytes_into(&mut self, n: usize, buf: &mut Vec<u8>) {
+        let mut read = 0;
+        while read < n {
+            let run = self.next_run(n - read);
+            if run.is_empty() {
+                break;
+            }
+            buf.extend_from_slice(run);
+            read += run.len();
+        }
+    }
+}
 
 pub struct Bitstream<T> {
     inner: T,
@@ -15,6 +170,29 @@ impl<T: Iterator<Item = u8>> Bitstream<T> {
         }
     }
 
+    // Returns the underlying iterator. Iterator-backed bitstreams never read ahead by more than the
+    // bits that have been requested, so if the bitstream is byte aligned, no data is lost.
+    pub fn into_inner(self) -> T {
+        self.inner
+    }
+}
+
+impl<'a> Bitstream<RBSPSlice<'a>> {
+    /// Creates a bitstream that reads directly from an encapsulated NAL unit payload (everything
+    /// after the NAL unit header), removing emulation prevention bytes in bulk.
+    ///
+    /// Because this bitstream reads ahead up to 64 bits at a time, it cannot be converted back into
+    /// its source.
+    pub fn from_slice(buf: &'a [u8]) -> Self {
+        Self {
+            inner: RBSPSlice::new(buf),
+            next_bits: 0,
+            next_bits_length: 0,
+        }
+    }
+}
+
+impl<T: BitstreamSource> Bitstream<T> {
     pub fn byte_aligned(&self) -> bool {
         self.next_bits_length % 8 == 0
     }
@@ -23,14 +201,12 @@ impl<T: Iterator<Item = u8>> Bitstream<T> {
         if n > self.next_bits_length {
             n -= self.next_bits_length;
             self.next_bits_length = 0;
-            for _ in 0..(n / 8) {
-                if self.inner.next().is_none() {
-                    return false;
-                }
+            if self.inner.skip_bytes(n / 8) < n / 8 {
+                return false;
             }
             n %= 8;
             if n > 0 {
-                self.next_bits = match self.inner.next() {
+                self.next_bits = match self.inner.next_byte() {
                     Some(b) => b as u128,
                     None => return false,
                 };
@@ -46,11 +222,42 @@ impl<T: Iterator<Item = u8>> Bitstream<T> {
         BitstreamBits { bs: self }
     }
 
-    pub fn next_bits(&mut self, n: usize) -> Option<u64> {
+    // Attempts to top up the buffered bits with a whole word from the source. This never falls back
+    // to reading individual bytes, so iterator-backed sources are left untouched.
+    fn refill_word(&mut self) -> bool {
+        if self.next_bits_length > 64 {
+            return false;
+        }
+        match self.inner.next_word() {
+            Some((word, len)) => {
+                self.next_bits = (self.next_bits << (len * 8)) | word as u128;
+                self.next_bits_length += len * 8;
+                true
+            }
+            None => false,
+        }
+    }
+
+    // Buffers at least n bits, returning false if the source is exhausted first.
+    fn refill(&mut self, n: usize) -> bool {
         while self.next_bits_length < n {
-            let b = self.inner.next()? as u128;
-            self.next_bits = (self.next_bits << 8) | b;
-            self.next_bits_length += 8;
+            if !self.refill_word() {
+                match self.inner.next_byte() {
+                    Some(b) => {
+                        self.next_bits = (self.next_bits << 8) | b as u128;
+                        self.next_bits_length += 8;
+                    }
+                    None => return false,
+                }
+            }
+        }
+        true
+    }
+
+    #[inline]
+    pub fn next_bits(&mut self, n: usize) -> Option<u64> {
+        if self.next_bits_length < n && !self.refill(n) {
+            return None;
         }
         Some(((self.next_bits >> (self.next_bits_length - n)) & (0xffff_ffff_ffff_ffff >> (64 - n))) as u64)
     }
@@ -65,6 +272,39 @@ impl<T: Iterator<Item = u8>> Bitstream<T> {
         }
     }
 
+    // Reads an Exp-Golomb-coded unsigned integer. ITU-T H.264, 04/2017, 9.1
+    pub fn read_exp_golomb(&mut self) -> io::Result<u64> {
+        // if the whole code is buffered, decode it with a single leading zero count
+        if let Some(v) = self.read_buffered_exp_golomb() {
+            return Ok(v);
+        }
+        if self.refill_word() {
+            if let Some(v) = self.read_buffered_exp_golomb() {
+                return Ok(v);
+            }
+        }
+
+        let mut leading_zero_bits = 0;
+        while self.read_bits(1)? == 0 {
+            leading_zero_bits += 1;
+        }
+        Ok(self.read_bits(leading_zero_bits)? + (1 << leading_zero_bits) - 1)
+    }
+
+    fn read_buffered_exp_golomb(&mut self) -> Option<u64> {
+        let available = self.next_bits_length.min(64);
+        if available == 0 {
+            return None;
+        }
+        let window = ((self.next_bits >> (self.next_bits_length - available)) as u64) << (64 - available);
+        let len = 2 * window.leading_zeros() as usize + 1;
+        if len > available {
+            return None;
+        }
+        self.next_bits_length -= len;
+        Some((window >> (64 - len)) - 1)
+    }
+
     // Reads exactly the given number of bytes into a Vec. The bitstream must be byte aligned.
     pub fn read_bytes(&mut self, n: usize) -> io::Result<Vec<u8>> {
         if !self.byte_aligned() {
@@ -76,7 +316,7 @@ impl<T: Iterator<Item = u8>> Bitstream<T> {
             ret.push(self.read_bits(8)? as _);
             read += 1;
         }
-        ret.extend((&mut self.inner).take(n - read));
+        self.inner.read_bytes_into(n - read, &mut ret);
         if ret.len() < n {
             return Err(io::Error::new(io::ErrorKind::UnexpectedEof, "unexpected end of bitstream"));
         }
@@ -100,10 +340,6 @@ impl<T: Iterator<Item = u8>> Bitstream<T> {
         }
     }
 
-    pub fn into_inner(self) -> T {
-        self.inner
-    }
-
     pub fn decode<V: Decode>(&mut self, v: &mut V) -> io::Result<()> {
         *v = V::decode(self)?;
         Ok(())
@@ -114,7 +350,7 @@ pub struct BitstreamBits<'a, T> {
     bs: &'a mut Bitstream<T>,
 }
 
-impl<'a, T: Iterator<Item = u8>> Iterator for BitstreamBits<'a, T> {
+impl<'a, T: BitstreamSource> Iterator for BitstreamBits<'a, T> {
     type Item = bool;
 
     fn next(&mut self) -> Option<Self::Item> {
@@ -123,7 +359,7 @@ impl<'a, T: Iterator<Item = u8>> Iterator for BitstreamBits<'a, T> {
 }
 
 pub trait Decode: Sized {
-    fn decode<T: Iterator<Item = u8>>(bs: &mut Bitstream<T>) -> io::Result<Self>;
+    fn decode<T: BitstreamSource>(bs: &mut Bitstream<T>) -> io::Result<Self>;
 }
 
 pub struct BitstreamWriter<T: io::Write> {
@@ -237,7 +473,10 @@ macro_rules! encode {
 
 #[cfg(test)]
 mod test {
-    use super::{super::syntax_elements::U2, *};
+    use super::{
+        super::{syntax_elements::*, RBSP},
+        *,
+    };
 
     #[test]
     fn test_decode() {
@@ -249,6 +488,66 @@ mod test {
         assert_eq!(b.0, 1);
     }
 
+    #[test]
+    fn test_rbsp_slice() {
+        for data in [
+            &[0x00, 0x00, 0x03, 0x01][..],
+            &[0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x03][..],
+            &[0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x00, 0x00, 0x03, 0x09, 0x0a, 0x00, 0x00, 0x03][..],
+        ] {
+            let expected = RBSP::new(data.iter().copied()).into_iter().collect::<Vec<u8>>();
+            let mut rbsp = RBSPSlice::new(data);
+            assert_eq!(std::iter::from_fn(|| rbsp.next_byte()).collect::<Vec<u8>>(), expected);
+
+            let mut bs = Bitstream::from_slice(data);
+            assert_eq!(bs.read_bytes(expected.len()).unwrap(), expected);
+            assert!(bs.read_bits(1).is_err());
+
+            let mut bs = Bitstream::from_slice(data);
+            assert!(bs.advance_bits(expected.len() * 8 - 3));
+            assert_eq!(bs.read_bits(3).unwrap(), *expected.last().unwrap() as u64 & 7);
+            assert!(!bs.advance_bits(1));
+        }
+
+        // a long buffer made up mostly of zeros and threes to exercise runs of emulation prevention
+        let mut state = 1u32;
+        let data = (0..1000)
+            .map(|_| {
+                state = state.wrapping_mul(1103515245).wrapping_add(12345);
+                [0, 0, 0, 3, 3, 1, 0x80, 0xff][(state >> 16) as usize % 8]
+            })
+            .collect::<Vec<u8>>();
+        let mut expected = Bitstream::new(RBSP::new(data.iter().copied()));
+        let mut bs = Bitstream::from_slice(&data);
+        for n in (1..=64).cycle().take(100).chain([6]) {
+            assert_eq!(bs.read_bits(n).unwrap(), expected.read_bits(n).unwrap());
+        }
+        assert_eq!(bs.read_bytes(300).unwrap(), expected.read_bytes(300).unwrap());
+        assert_eq!(bs.advance_bits(1003), expected.advance_bits(1003));
+        assert_eq!(bs.bits().collect::<Vec<_>>(), expected.bits().collect::<Vec<_>>());
+    }
+
+    #[test]
+    fn test_read_exp_golomb() {
+        let values = [0, 1, 2, 3, 4, 30, 1000, 0, 0, 123456789, 1 << 40, 7];
+        let mut rbsp = Vec::new();
+        {
+            let mut bs = BitstreamWriter::new(&mut rbsp);
+            for &v in &values {
+                UE(v).encode(&mut bs).unwrap();
+            }
+            ByteAlignment.encode(&mut bs).unwrap();
+        }
+        let data = super::super::EmulationPrevention::new(rbsp).collect::<Vec<u8>>();
+
+        let mut bs = Bitstream::new(RBSP::new(data.iter().copied()));
+        assert_eq!(values.map(|_| UE::decode(&mut bs).unwrap().0), values);
+
+        let mut bs = Bitstream::from_slice(&data);
+        assert_eq!(values.map(|_| UE::decode(&mut bs).unwrap().0), values);
+        assert!(!bs.more_non_slice_rbsp_data());
+    }
+
     #[test]
     fn test_encode() {
         let mut b = Vec::new();
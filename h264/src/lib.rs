@@ -1,5 +1,4 @@
 use std::{
-    collections::VecDeque,
     io::{self, Read},
     iter::Iterator,
 };
@@ -105,21 +104,65 @@ impl<'a> Iterator for AnnexBIter<'a> {
     }
 }
 
+/// The amount of spare capacity [`ReadAnnexB`] ensures is available before each read.
+pub const READ_ANNEX_B_CHUNK_SIZE: usize = 1024 * 1024;
+
+/// Iterator over NALs read from an Annex B-encoded stream as returned by [`read_annex_b`].
 pub struct ReadAnnexB<T> {
+    // the unconsumed data followed by zeroed space for the next read. if a start code has been
+    // found, this begins at the current nal
     buf: bytes::BytesMut,
-    offset: usize,
+    // how much of buf contains data
+    filled: usize,
+    // how much of buf is known not to contain a start code
+    scanned: usize,
+    found_start_code: bool,
+    eof: bool,
     reader: T,
-    start_codes: VecDeque<(usize, usize)>,
-    zeros: usize,
 }
 
+/// Reads start code-prefixed NALs from `reader`.
+///
+/// NALs are split at start codes and have trailing zeros removed, as with [`iterate_annex_b`].
+/// Unlike [`iterate_annex_b`], the stream doesn't have to begin with a start code: any bytes before
+/// the first `00 00 01` are discarded. If there is no start code at all, no NALs are returned.
+///
+/// Data is read in chunks of [`READ_ANNEX_B_CHUNK_SIZE`] and each NAL is returned as a slice of the chunk it was read into, so
+/// NALs are only copied if they span multiple chunks. Once all previously returned NALs are dropped,
+/// the chunk's allocation is reused for subsequent reads.
 pub fn read_annex_b<T: Read>(reader: T) -> ReadAnnexB<T> {
     ReadAnnexB {
         buf: bytes::BytesMut::new(),
-        offset: 0,
+        filled: 0,
+        scanned: 0,
+        found_start_code: false,
+        eof: false,
         reader,
-        start_codes: VecDeque::new(),
-        zeros: 0,
+    }
+}
+
+impl<T: Read> ReadAnnexB<T> {
+    // Reads more data into buf, returning the number of bytes read.
+    fn fill_buf(&mut self) -> io::Result<usize> {
+        if self.filled == self.buf.len() {
+            self.buf.reserve(READ_ANNEX_B_CHUNK_SIZE);
+            self.buf.resize(self.filled + READ_ANNEX_B_CHUNK_SIZE, 0);
+        }
+        loop {
+            match self.reader.read(&mut self.buf[self.filled..]) {
+                Ok(n) => {
+                    self.filled += n;
+                    return Ok(n);
+                }
+                Err(e) if e.kind() == io::ErrorKind::Interrupted => continue,
+                Err(e) => return Err(e),
+            }
+        }
+    }
+
+    fn advance(&mut self, n: usize) {
+        bytes::Buf::advance(&mut self.buf, n);
+        self.filled -= n;
     }
 }
 
@@ -127,57 +170,187 @@ impl<T: Read> Iterator for ReadAnnexB<T> {
     type Item = io::Result<bytes::Bytes>;
 
     fn next(&mut self) -> Option<Self::Item> {
-        // append to buf until we have 2+ start codes
-        while self.start_codes.len() < 2 {
-            self.buf.resize(self.offset + 1024, 0);
-            let n = match self.reader.read(&mut self.buf[self.offset..]) {
-                Ok(n) => n,
-                Err(e) => return Some(Err(e)),
-            };
-            if n == 0 {
-                break;
+        let finder = START_CODE_FINDER.get_or_init(|| memchr::memmem::Finder::new(&START_CODE));
+        loop {
+            if let Some(idx) = finder.find(&self.buf[self.scanned..self.filled]) {
+                let idx = self.scanned + idx;
+                self.scanned = 0;
+                if self.found_start_code {
+                    let mut nalu = self.buf.split_to(idx).freeze();
+                    self.filled -= idx;
+                    self.advance(START_CODE.len());
+                    nalu.truncate(nalu.len() - nalu.iter().rev().take_while(|&&b| b == 0).count());
+                    return Some(Ok(nalu));
+                }
+                // discard anything before the first start code
+                self.advance(idx + START_CODE.len());
+                self.found_start_code = true;
+                continue;
             }
-            for (i, &b) in self.buf[self.offset..self.offset + n].iter().enumerate() {
-                match b {
-                    0 => self.zeros += 1,
-                    1 if self.zeros >= 2 => {
-                        self.start_codes.push_back((self.offset + i - self.zeros, self.zeros + 1));
-                        self.zeros = 0;
-                    }
-                    _ => self.zeros = 0,
+
+            if self.eof {
+                if !self.found_start_code {
+                    return None;
                 }
+                // this is the last nalu
+                self.found_start_code = false;
+                self.scanned = 0;
+                let mut nalu = self.buf.split_to(self.filled).freeze();
+                self.filled = 0;
+                nalu.truncate(nalu.len() - nalu.iter().rev().take_while(|&&b| b == 0).count());
+                return Some(Ok(nalu));
+            }
+
+            // a start code may begin in the last two bytes, so they need to be scanned again once
+            // more data is available
+            self.scanned = self.filled.saturating_sub(START_CODE.len() - 1);
+            if !self.found_start_code {
+                self.advance(self.scanned);
+                self.scanned = 0;
+            }
+
+            match self.fill_buf() {
+                Ok(0) => self.eof = true,
+                Ok(_) => {}
+                Err(e) => return Some(Err(e)),
             }
-            self.offset += n;
         }
+    }
+}
 
-        // return the next nalu
-        match self.start_codes.pop_front() {
-            Some((start_code_offset, start_code_len)) => match self.start_codes.front() {
-                Some(&(next_start_code_offset, _)) => {
-                    // this is not the last nalu. freeze the current buffer and copy the unused
-                    // bits to a new one
-                    let buf = std::mem::take(&mut self.buf).freeze();
-                    let item = Some(Ok(buf.slice(start_code_offset + start_code_len..next_start_code_offset)));
-                    let unused = buf.slice(next_start_code_offset..);
-                    self.buf.extend_from_slice(&unused);
-                    self.offset -= next_start_code_offset;
-                    for (o, _) in self.start_codes.iter_mut() {
-                        *o -= next_start_code_offset;
-                    }
-                    item
-                }
-                None => {
-                    // this is the last nalu
-                    let buf = std::mem::take(&mut self.buf).freeze();
-                    let item = Some(Ok(buf.slice(start_code_offset + start_code_len..self.offset)));
-                    self.offset = 0;
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+enum AnnexBScannerState {
+    // looking for the leading start code. if anything else is found, the rest of the data is ignored
+    Leading,
+    Nalu,
+    Ignore,
+}
+
+/// Delimits NALs in Annex B-encoded data that arrives in arbitrarily split chunks, such as the
+/// payloads of the transport stream packets that make up a PES packet.
+///
+/// NALs are split at start codes and have trailing zeros removed, as [`iterate_annex_b`] would do
+/// with the concatenated chunks, but the chunks are never concatenated. As with [`iterate_annex_b`],
+/// the data must begin with a start code: if anything other than zeros followed by `01` comes
+/// first, everything up to the next [`reset`](Self::reset) is ignored. This differs from
+/// [`read_annex_b`], which discards bytes before the first start code. Only the first `prefix_len` bytes of each NAL are retained,
+/// unless `select` returns true for the NAL's first byte, in which case the whole NAL is retained.
+/// Empty NALs are skipped.
+#[derive(Clone)]
+pub struct AnnexBScanner {
+    prefix_len: usize,
+    select: fn(u8) -> bool,
+    state: AnnexBScannerState,
+    // the number of consecutive zeros at the end of the data seen so far
+    zeros: usize,
+    // the length of the current nalu, including any trailing zeros
+    nalu_len: usize,
+    // how much of the current nalu will be retained
+    nalu_limit: usize,
+    nalu: Vec<u8>,
+}
+
+impl AnnexBScanner {
+    pub fn new(prefix_len: usize, select: fn(u8) -> bool) -> Self {
+        Self {
+            prefix_len,
+            select,
+            state: AnnexBScannerState::Leading,
+            zeros: 0,
+            nalu_len: 0,
+            nalu_limit: 0,
+            nalu: Vec::new(),
+        }
+    }
+
+    /// Scans the next chunk of data. `f` is invoked with each NAL that is completed by it.
+    pub fn write<E, F: FnMut(&[u8]) -> Result<(), E>>(&mut self, mut chunk: &[u8], mut f: F) -> Result<(), E> {
+        if self.state == AnnexBScannerState::Leading {
+            let zeros = chunk.iter().take_while(|&&b| b == 0).count();
+            self.zeros += zeros;
+            chunk = &chunk[zeros..];
+            match chunk.first() {
+                None => return Ok(()),
+                Some(1) if self.zeros >= 2 => {
+                    self.state = AnnexBScannerState::Nalu;
                     self.zeros = 0;
-                    item
+                    chunk = &chunk[1..];
                 }
-            },
-            // no more nalus
-            None => None,
+                Some(_) => self.state = AnnexBScannerState::Ignore,
+            }
+        }
+
+        if self.state != AnnexBScannerState::Nalu || chunk.is_empty() {
+            return Ok(());
         }
+
+        // the previous chunk may have ended with the beginning of a start code
+        let spanning_start_code_len = if self.zeros >= 2 && chunk[0] == 1 {
+            1
+        } else if self.zeros >= 1 && chunk.starts_with(&[0, 1]) {
+            2
+        } else {
+            0
+        };
+        if spanning_start_code_len > 0 {
+            self.end_nalu(&mut f)?;
+            chunk = &chunk[spanning_start_code_len..];
+        }
+
+        // start codes within the chunk are found in a single pass
+        let finder = START_CODE_FINDER.get_or_init(|| memchr::memmem::Finder::new(&START_CODE));
+        let mut nalu_start = 0;
+        while let Some(idx) = finder.find(&chunk[nalu_start..]) {
+            let idx = nalu_start + idx;
+            self.extend_nalu(&chunk[nalu_start..idx]);
+            self.end_nalu(&mut f)?;
+            nalu_start = idx + START_CODE.len();
+        }
+        self.extend_nalu(&chunk[nalu_start..]);
+        Ok(())
+    }
+
+    /// Signals the end of the data, completing the final NAL. Subsequent writes are expected to
+    /// begin with a start code again.
+    pub fn finish<E, F: FnMut(&[u8]) -> Result<(), E>>(&mut self, mut f: F) -> Result<(), E> {
+        let result = match self.state {
+            AnnexBScannerState::Nalu => self.end_nalu(&mut f),
+            _ => Ok(()),
+        };
+        self.reset();
+        result
+    }
+
+    /// Discards any partial NAL and prepares for data beginning with a start code.
+    pub fn reset(&mut self) {
+        self.state = AnnexBScannerState::Leading;
+        self.zeros = 0;
+        self.nalu_len = 0;
+        self.nalu.clear();
+    }
+
+    fn extend_nalu(&mut self, data: &[u8]) {
+        if data.is_empty() {
+            return;
+        }
+        if self.nalu_len == 0 {
+            self.nalu_limit = if (self.select)(data[0]) { usize::MAX } else { self.prefix_len };
+        }
+        let n = data.len().min(self.nalu_limit.saturating_sub(self.nalu.len()));
+        self.nalu.extend_from_slice(&data[..n]);
+        self.nalu_len += data.len();
+        let zeros = data.iter().rev().take_while(|&&b| b == 0).count();
+        self.zeros = if zeros == data.len() { self.zeros + zeros } else { zeros };
+    }
+
+    fn end_nalu<E, F: FnMut(&[u8]) -> Result<(), E>>(&mut self, f: &mut F) -> Result<(), E> {
+        // trailing zeros aren't part of the nalu
+        let len = self.nalu.len().min(self.nalu_len - self.zeros);
+        let result = if len > 0 { f(&self.nalu[..len]) } else { Ok(()) };
+        self.zeros = 0;
+        self.nalu_len = 0;
+        self.nalu.clear();
+        result
     }
 }
 
@@ -219,9 +392,7 @@ impl AccessUnitCounter {
             1..=2 => {
                 if self.maybe_start_new_access_unit {
                     if let Some(sps) = &self.sps {
-                        let bs = Bitstream::new(nalu.iter().copied());
-                        let mut nalu = NALUnit::decode(bs)?;
-                        let mut rbsp = Bitstream::new(&mut nalu.rbsp_byte);
+                        let mut rbsp = Bitstream::from_slice(&nalu[1..]);
                         let slice_header = SliceHeader::decode(&mut rbsp, sps)?;
                         if slice_header.frame_num != self.prev_frame_num {
                             self.prev_frame_num = slice_header.frame_num;
@@ -242,9 +413,7 @@ impl AccessUnitCounter {
         }
 
         if let NAL_UNIT_TYPE_SEQUENCE_PARAMETER_SET = nalu_type {
-            let bs = Bitstream::new(nalu.iter().copied());
-            let mut nalu = NALUnit::decode(bs)?;
-            let mut rbsp = Bitstream::new(&mut nalu.rbsp_byte);
+            let mut rbsp = Bitstream::from_slice(&nalu[1..]);
             let sps = SequenceParameterSet::decode(&mut rbsp)?;
             self.sps = Some(sps);
         }
@@ -272,6 +441,84 @@ mod test {
         let data = &[0u8, 0x00, 0x00, 0x01, 0x01, 0x02, 0x03, 0x00, 0x00, 0x00, 0x01, 0x04];
         let expected: Vec<bytes::Bytes> = vec![[1u8, 0x02, 0x03].as_ref().into(), [4u8].as_ref().into()];
         assert_eq!(expected, read_annex_b(data.as_ref()).collect::<io::Result<Vec<bytes::Bytes>>>().unwrap());
+
+        assert_eq!(read_annex_b([].as_ref()).count(), 0);
+        assert_eq!(read_annex_b([0x01, 0x02, 0x03].as_ref()).count(), 0);
+    }
+
+    #[test]
+    fn test_read_annex_b_leading_bytes() {
+        // iterate_annex_b returns nothing for data that doesn't begin with a start code, but
+        // read_annex_b discards the bytes before the first one
+        let data = [0xff, 0x01, 0x00, 0x00, 0x01, 0x01, 0x02, 0x00, 0x00, 0x01, 0x03];
+        assert_eq!(iterate_annex_b(&data).count(), 0);
+        let expected: Vec<bytes::Bytes> = vec![[0x01u8, 0x02].as_ref().into(), [0x03u8].as_ref().into()];
+        assert_eq!(read_annex_b(data.as_ref()).collect::<io::Result<Vec<bytes::Bytes>>>().unwrap(), expected);
+    }
+
+    #[test]
+    fn test_read_annex_b_split_reads() {
+        // returns at most n bytes per read so that start codes are split across reads
+        struct ShortReads<'a>(&'a [u8], usize);
+
+        impl<'a> Read for ShortReads<'a> {
+            fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+                let n = self.1.min(buf.len()).min(self.0.len());
+                buf[..n].copy_from_slice(&self.0[..n]);
+                self.0 = &self.0[n..];
+                Ok(n)
+            }
+        }
+
+        let data = [
+            0xff, 0x00, 0x00, 0x01, 0x01, 0x02, 0x03, 0x00, 0x00, 0x00, 0x01, 0x04, 0x00, 0x00, 0x01, 0x00, 0x00, 0x01, 0x05, 0x00, 0x00, 0x02, 0x00,
+        ];
+        let expected: Vec<&[u8]> = vec![&[0x01, 0x02, 0x03], &[0x04], &[], &[0x05, 0x00, 0x00, 0x02]];
+        for n in 1..=data.len() {
+            let nalus = read_annex_b(ShortReads(&data, n)).collect::<io::Result<Vec<bytes::Bytes>>>().unwrap();
+            assert_eq!(nalus, expected, "reads of {} bytes", n);
+        }
+    }
+
+    #[test]
+    fn test_annex_b_scanner() {
+        let data = [
+            0x00, 0x00, 0x01, 0x01, 0x02, 0x03, 0x00, 0x00, 0x00, 0x01, 0x04, 0x00, 0x00, 0x01, 0x00, 0x00, 0x01, 0x05, 0x06, 0x07, 0x00, 0x00, 0x02, 0x00,
+            0x00,
+        ];
+        let expected = iterate_annex_b(&data).filter(|nalu| !nalu.is_empty()).collect::<Vec<_>>();
+        assert_eq!(expected.len(), 3);
+
+        let scan = |chunks: &[&[u8]], prefix_len: usize| {
+            let mut scanner = AnnexBScanner::new(prefix_len, |b| b == 0x05);
+            let mut nalus = Vec::new();
+            let mut push = |nalu: &[u8]| -> Result<(), ()> {
+                nalus.push(nalu.to_vec());
+                Ok(())
+            };
+            for chunk in chunks {
+                scanner.write(chunk, &mut push).unwrap();
+            }
+            scanner.finish(&mut push).unwrap();
+            nalus
+        };
+
+        // every way of splitting the data into three chunks should give the same nalus
+        for i in 0..=data.len() {
+            for j in i..=data.len() {
+                let chunks = [&data[..i], &data[i..j], &data[j..]];
+                assert_eq!(scan(&chunks, usize::MAX), expected, "chunks split at {} and {}", i, j);
+
+                // only the selected nalu should be retained in full
+                let nalus = scan(&chunks, 2);
+                assert_eq!(nalus, vec![&expected[0][..2], expected[1], expected[2]]);
+            }
+        }
+
+        assert!(scan(&[&[0x00, 0x00], &[0x02, 0x00, 0x00, 0x01, 0x01]], usize::MAX).is_empty());
+
+        // unlike read_annex_b, leading bytes before the first start code aren't skipped
+        assert!(scan(&[&[0xff, 0x00], &[0x00, 0x01, 0x01]], usize::MAX).is_empty());
     }
 
     #[test]
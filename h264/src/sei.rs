@@ -1,4 +1,4 @@
-use super::{decode, encode, sequence_parameter_set::VUIParameters, syntax_elements::*, Bitstream, BitstreamWriter, Decode, Encode};
+use super::{decode, encode, sequence_parameter_set::VUIParameters, syntax_elements::*, Bitstream, BitstreamSource, BitstreamWriter, Decode, Encode};
 
 use std::io;
 
@@ -12,7 +12,7 @@ pub struct SEI {
 }
 
 impl Decode for SEI {
-    fn decode<T: Iterator<Item = u8>>(bs: &mut Bitstream<T>) -> io::Result<Self> {
+    fn decode<T: BitstreamSource>(bs: &mut Bitstream<T>) -> io::Result<Self> {
         let mut ret = Self::default();
         loop {
             ret.sei_message.push(SEIMessage::decode(bs)?);
@@ -41,7 +41,7 @@ pub struct SEIMessage {
 }
 
 impl Decode for SEIMessage {
-    fn decode<T: Iterator<Item = u8>>(bs: &mut Bitstream<T>) -> io::Result<Self> {
+    fn decode<T: BitstreamSource>(bs: &mut Bitstream<T>) -> io::Result<Self> {
         let mut ret = Self::default();
 
         let mut payload_type = 0;
@@ -117,7 +117,7 @@ pub struct Timecode {
 }
 
 impl PicTiming {
-    pub fn decode<T: Iterator<Item = u8>>(bs: &mut Bitstream<T>, vui_params: &VUIParameters) -> io::Result<Self> {
+    pub fn decode<T: BitstreamSource>(bs: &mut Bitstream<T>, vui_params: &VUIParameters) -> io::Result<Self> {
         let mut ret = Self::default();
 
         let hrd_params = vui_params.nal_hrd_parameters.as_ref().or(vui_params.vcl_hrd_parameters.as_ref());
@@ -273,7 +273,7 @@ fn bcd_decode(bcd: u8) -> u8 {
 }
 
 impl AVCHDMetadata {
-    pub fn decode<T: Iterator<Item = u8>>(bs: &mut Bitstream<T>) -> io::Result<Self> {
+    pub fn decode<T: BitstreamSource>(bs: &mut Bitstream<T>) -> io::Result<Self> {
         let mut ret = Self::default();
 
         let magic = bs.read_bits(32)?;
@@ -346,6 +346,13 @@ mod test {
         assert_eq!(1, sei.sei_message[1].payload_type);
         assert_eq!(4, sei.sei_message[2].payload_type);
 
+        let sei_from_slice = SEI::decode(&mut Bitstream::from_slice(&data)).unwrap();
+        assert_eq!(3, sei_from_slice.sei_message.len());
+        for (a, b) in sei.sei_message.iter().zip(&sei_from_slice.sei_message) {
+            assert_eq!(a.payload_type, b.payload_type);
+            assert_eq!(a.payload, b.payload);
+        }
+
         let pic_timing = PicTiming::decode(&mut Bitstream::new(sei.sei_message[1].payload.iter().copied()), &sps.vui_parameters).unwrap();
         assert_eq!(68, pic_timing.cpb_removal_delay);
         assert_eq!(2, pic_timing.dpb_output_delay);
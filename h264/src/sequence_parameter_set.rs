@@ -1,4 +1,4 @@
-use super::{decode, encode, syntax_elements::*, Bitstream, BitstreamWriter, Decode, Encode};
+use super::{decode, encode, syntax_elements::*, Bitstream, BitstreamSource, BitstreamWriter, Decode, Encode};
 
 use std::io;
 
@@ -163,7 +163,7 @@ impl SequenceParameterSet {
 }
 
 impl Decode for SequenceParameterSet {
-    fn decode<T: Iterator<Item = u8>>(bs: &mut Bitstream<T>) -> io::Result<Self> {
+    fn decode<T: BitstreamSource>(bs: &mut Bitstream<T>) -> io::Result<Self> {
         let mut ret = Self::default();
 
         decode!(
@@ -346,7 +346,7 @@ impl VUIParameters {
 }
 
 impl Decode for VUIParameters {
-    fn decode<T: Iterator<Item = u8>>(bs: &mut Bitstream<T>) -> io::Result<Self> {
+    fn decode<T: BitstreamSource>(bs: &mut Bitstream<T>) -> io::Result<Self> {
         let mut ret = Self::default();
 
         decode!(bs, &mut ret.aspect_ratio_info_present_flag)?;
@@ -517,7 +517,7 @@ pub struct HRDParameters {
 }
 
 impl Decode for HRDParameters {
-    fn decode<T: Iterator<Item = u8>>(bs: &mut Bitstream<T>) -> io::Result<Self> {
+    fn decode<T: BitstreamSource>(bs: &mut Bitstream<T>) -> io::Result<Self> {
         let mut ret = Self::default();
 
         decode!(bs, &mut ret.cpb_cnt_minus1, &mut ret.bit_rate_scale, &mut ret.cpb_size_scale)?;
@@ -564,7 +564,7 @@ pub struct SEISched {
 }
 
 impl Decode for SEISched {
-    fn decode<T: Iterator<Item = u8>>(bs: &mut Bitstream<T>) -> io::Result<Self> {
+    fn decode<T: BitstreamSource>(bs: &mut Bitstream<T>) -> io::Result<Self> {
         let mut ret = Self::default();
         decode!(bs, &mut ret.bit_rate_value_minus1, &mut ret.cpb_size_value_minus1, &mut ret.cbr_flag)?;
         Ok(ret)
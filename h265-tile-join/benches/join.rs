@@ -0,0 +1,35 @@
+//! Benchmarks joining copies of the xilinx crate's test video into increasing numbers of tiles,
+//! reading each input from an Annex B stream as the command line tool does.
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+const TILE_COUNTS: &[usize] = &[1, 2, 4, 8, 16];
+
+include!(concat!(env!("CARGO_MANIFEST_DIR"), "/../h265/testdata/sample.rs"));
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let input = sample_annex_b();
+    let mut output = Vec::new();
+
+    let mut g = c.benchmark_group("join");
+    g.sample_size(10);
+    for &tiles in TILE_COUNTS {
+        g.throughput(Throughput::Bytes((input.len() * tiles) as u64));
+        g.bench_with_input(BenchmarkId::new("join", tiles), &tiles, |b, &tiles| {
+            b.iter(|| {
+                output.clear();
+                h265_tile_join::join((0..tiles).map(|_| h265::read_annex_b(&input[..])), &mut output).unwrap();
+            })
+        });
+        g.bench_with_input(BenchmarkId::new("join_parallel", tiles), &tiles, |b, &tiles| {
+            b.iter(|| {
+                output.clear();
+                h265_tile_join::join_parallel((0..tiles).map(|_| h265::read_annex_b(&input[..])), &mut output).unwrap();
+            })
+        });
+    }
+    g.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
@@ -1,11 +1,19 @@
 use h265::{
     Bitstream, BitstreamWriter, Decode, EmulationPrevention, Encode, NALUnit, NALUnitHeader, PictureParameterSet, SequenceParameterSet, SliceSegmentHeader,
+    RBSP,
 };
 use std::{
     collections::VecDeque,
     io::{self, Write},
+    panic,
+    sync::mpsc,
+    thread,
 };
 
+// The number of NALUs each input's worker may get ahead of the output. This bounds the memory used
+// by join_parallel regardless of input length.
+const PIPELINE_DEPTH: usize = 8;
+
 pub fn join<I, II, T, E, Iter, O>(inputs: II, mut output: O) -> Result<(), E>
 where
     E: From<io::Error>,
@@ -16,21 +24,10 @@ where
     O: Write,
 {
     let mut inputs = inputs.into_iter().map(|input| Input::new(input.into_iter())).collect::<Result<Vec<_>, E>>()?;
+    let params = JoinedParameterSets::new(&inputs)?;
 
-    let input_0_sps = inputs[0].sps.clone();
-    #[allow(clippy::redundant_clone)] // erroneous suggestion.
-    let mut sps = input_0_sps.clone();
-    sps.pic_width_in_luma_samples.0 = 0;
-    for input in &inputs {
-        sps.pic_width_in_luma_samples.0 += input.sps.pic_width_in_luma_samples.0;
-    }
-
-    let input_0_pps = inputs[0].pps.clone();
-    #[allow(clippy::redundant_clone)] // erroneous suggestion.
-    let mut pps = input_0_pps.clone();
-    pps.tiles_enabled_flag.0 = 1;
-    pps.num_tile_columns_minus1.0 = inputs.len() as u64 - 1;
-    pps.uniform_spacing_flag.0 = 1;
+    let mut header_buf = Vec::new();
+    let mut scratch = Vec::new();
 
     while let Some(nalu) = inputs[0].next_nalu() {
         let nalu = nalu?;
@@ -42,74 +39,39 @@ where
             h265::NAL_UNIT_TYPE_SPS_NUT => {
                 output.write_all(&[0, 0, 0, 1])?;
                 nalu_header.encode(&mut BitstreamWriter::new(&mut output))?;
-                let mut buf = Vec::new();
-                sps.encode(&mut BitstreamWriter::new(&mut buf))?;
-                let buf = EmulationPrevention::new(buf).collect::<Vec<u8>>();
-                output.write_all(&buf)?;
+                output.write_all(&params.sps_payload)?;
             }
             h265::NAL_UNIT_TYPE_PPS_NUT => {
                 output.write_all(&[0, 0, 0, 1])?;
                 nalu_header.encode(&mut BitstreamWriter::new(&mut output))?;
-                let mut buf = Vec::new();
-                pps.encode(&mut BitstreamWriter::new(&mut buf))?;
-                let buf = EmulationPrevention::new(buf).collect::<Vec<u8>>();
-                output.write_all(&buf)?;
+                output.write_all(&params.pps_payload)?;
             }
             1..=9 | 16..=21 => {
-                // parse the header
-                let bs = Bitstream::new(nalu.iter().copied());
-                let mut nalu = NALUnit::decode(bs)?;
-                let mut header = SliceSegmentHeader::decode(
-                    &mut Bitstream::new(&mut nalu.rbsp_byte),
-                    nalu.nal_unit_header.nal_unit_type.0,
-                    &input_0_sps,
-                    &input_0_pps,
-                )?;
+                let mut segment = SliceSegment::decode(nalu, &params.input_0_sps, &params.input_0_pps)?;
 
                 // write out the new nalus
+                header_buf.clear();
+                params.write_slice_segment_prefix(&mut header_buf, &mut scratch, &nalu_header, &segment.header)?;
+                output.write_all(&header_buf)?;
+                output.write_all(&nalu[segment.data_offset..])?;
 
-                let slice_data = nalu.rbsp_byte.into_inner().collect::<Vec<u8>>();
-                output.write_all(&[0, 0, 0, 1])?;
-                nalu_header.encode(&mut BitstreamWriter::new(&mut output))?;
-                let mut buf = Vec::new();
-                header.encode(&mut BitstreamWriter::new(&mut buf), nalu_header.nal_unit_type.0, &sps, &pps)?;
-                let buf = EmulationPrevention::new(buf).collect::<Vec<u8>>();
-                output.write_all(&buf)?;
-                output.write_all(&slice_data)?;
-
-                let mut ctb_x = input_0_sps.PicWidthInCtbsY();
-                for input in &mut inputs[1..] {
-                    header.first_slice_segment_in_pic_flag.0 = 0;
-                    header.slice_segment_address = ctb_x;
-                    ctb_x += input.sps.PicWidthInCtbsY();
+                for (input, &ctb_x) in inputs[1..].iter_mut().zip(&params.tile_addresses) {
+                    segment.header.first_slice_segment_in_pic_flag.0 = 0;
+                    segment.header.slice_segment_address = ctb_x;
 
                     loop {
                         let nalu = match input.next_nalu() {
                             Some(nalu) => nalu?,
                             None => return Err(io::Error::new(io::ErrorKind::UnexpectedEof, "matching slice segment not found").into()),
                         };
-                        let bs = Bitstream::new(nalu.iter().copied());
-                        let mut nalu = NALUnit::decode(bs)?;
-
-                        match nalu.nal_unit_header.nal_unit_type.0 {
-                            1..=9 | 16..=21 => {
-                                SliceSegmentHeader::decode(
-                                    &mut Bitstream::new(&mut nalu.rbsp_byte),
-                                    nalu.nal_unit_header.nal_unit_type.0,
-                                    &input_0_sps,
-                                    &input_0_pps,
-                                )?;
-                                output.write_all(&[0, 0, 0, 1])?;
-                                nalu_header.encode(&mut BitstreamWriter::new(&mut output))?;
-                                let mut buf = Vec::new();
-                                header.encode(&mut BitstreamWriter::new(&mut buf), nalu_header.nal_unit_type.0, &sps, &pps)?;
-                                let buf = EmulationPrevention::new(buf).collect::<Vec<u8>>();
-                                output.write_all(&buf)?;
-                                let slice_data = nalu.rbsp_byte.into_inner().collect::<Vec<u8>>();
-                                output.write_all(&slice_data)?;
-                                break;
-                            }
-                            _ => {}
+                        let mut bs = Bitstream::new(nalu.iter().copied());
+                        if let 1..=9 | 16..=21 = NALUnitHeader::decode(&mut bs)?.nal_unit_type.0 {
+                            let data_offset = SliceSegment::decode(nalu, &params.input_0_sps, &params.input_0_pps)?.data_offset;
+                            header_buf.clear();
+                            params.write_slice_segment_prefix(&mut header_buf, &mut scratch, &nalu_header, &segment.header)?;
+                            output.write_all(&header_buf)?;
+                            output.write_all(&nalu[data_offset..])?;
+                            break;
                         }
                     }
                 }
@@ -124,6 +86,223 @@ where
     Ok(())
 }
 
+/// Like `join`, but parses each input on its own thread.
+///
+/// The first input's worker also rewrites the parameter sets and slice segment headers, while the
+/// other inputs' workers only locate the slice segment data for their tiles. The output is written
+/// on the calling thread in frame order, with the slice segment data taken directly from the input
+/// NALUs. Each worker stays at most a few NALUs ahead of the output.
+pub fn join_parallel<I, II, T, E, Iter, O>(inputs: II, mut output: O) -> Result<(), E>
+where
+    E: From<io::Error> + Send,
+    T: AsRef<[u8]> + Send,
+    I: IntoIterator<Item = Result<T, E>, IntoIter = Iter>,
+    II: IntoIterator<Item = I>,
+    Iter: Iterator<Item = Result<T, E>> + Send,
+    O: Write,
+{
+    // find every input's parameter sets
+    let inputs = thread::scope(|s| -> Result<Vec<_>, E> {
+        let workers = inputs
+            .into_iter()
+            .enumerate()
+            .map(|(i, input)| {
+                let nalus = input.into_iter();
+                spawn_worker(s, i, move || Input::new(nalus))
+            })
+            .collect::<io::Result<Vec<_>>>()?;
+        workers
+            .into_iter()
+            .map(|worker| worker.join().unwrap_or_else(|e| panic::resume_unwind(e)))
+            .collect()
+    })?;
+    let params = JoinedParameterSets::new(&inputs)?;
+
+    thread::scope(|s| -> Result<(), E> {
+        let params = &params;
+        let mut inputs = inputs.into_iter();
+        let input_0 = inputs.next().expect("the parameter sets can't be joined without inputs");
+
+        let mut tiles = Vec::with_capacity(inputs.len());
+        for (i, input) in inputs.enumerate() {
+            let (tx, rx) = mpsc::sync_channel(PIPELINE_DEPTH);
+            spawn_worker(s, i + 1, move || input.send_slice_segment_data(params, tx))?;
+            tiles.push(rx);
+        }
+
+        // header buffers are handed back to the first input's worker once they've been written
+        let (recycled_tx, recycled_rx) = mpsc::sync_channel(PIPELINE_DEPTH);
+        let (tx, rx) = mpsc::sync_channel(PIPELINE_DEPTH);
+        spawn_worker(s, 0, move || input_0.send_output_units(params, tx, recycled_rx))?;
+
+        for unit in rx {
+            match unit? {
+                OutputUnit::NALUnit(nalu) => {
+                    output.write_all(&[0, 0, 0, 1])?;
+                    output.write_all(nalu.as_ref())?;
+                }
+                OutputUnit::ParameterSet(nalu_header, payload) => {
+                    output.write_all(&[0, 0, 0, 1])?;
+                    nalu_header.encode(&mut BitstreamWriter::new(&mut output))?;
+                    output.write_all(payload)?;
+                }
+                OutputUnit::SliceSegment { headers, nalu, data_offset } => {
+                    output.write_all(&headers[0])?;
+                    output.write_all(&nalu.as_ref()[data_offset..])?;
+                    for (header, tile) in headers[1..].iter().zip(&tiles) {
+                        let (nalu, data_offset) = match tile.recv() {
+                            Ok(r) => r?,
+                            Err(_) => return Err(io::Error::new(io::ErrorKind::UnexpectedEof, "matching slice segment not found").into()),
+                        };
+                        output.write_all(header)?;
+                        output.write_all(&nalu.as_ref()[data_offset..])?;
+                    }
+                    // if the worker already has enough spare buffers, these are just dropped
+                    let _ = recycled_tx.try_send(headers);
+                }
+            }
+        }
+
+        Ok(())
+    })
+}
+
+fn spawn_worker<'scope, 'env, F, R>(s: &'scope thread::Scope<'scope, 'env>, input: usize, f: F) -> io::Result<thread::ScopedJoinHandle<'scope, R>>
+where
+    F: FnOnce() -> R + Send + 'scope,
+    R: Send + 'scope,
+{
+    thread::Builder::new().name(format!("h265-tile-join-{}", input)).spawn_scoped(s, f)
+}
+
+// The parameter sets of the joined stream, along with everything needed to turn the inputs' slice
+// segments into its tiles.
+struct JoinedParameterSets {
+    input_0_sps: SequenceParameterSet,
+    input_0_pps: PictureParameterSet,
+    sps: SequenceParameterSet,
+    pps: PictureParameterSet,
+    // the escaped payloads of the joined parameter set NALUs
+    sps_payload: Vec<u8>,
+    pps_payload: Vec<u8>,
+    // the address of the first CTB of each tile after the first
+    tile_addresses: Vec<u64>,
+}
+
+impl JoinedParameterSets {
+    fn new<Iter, T>(inputs: &[Input<Iter, T>]) -> io::Result<Self> {
+        let input_0_sps = inputs[0].sps.clone();
+        let mut sps = input_0_sps.clone();
+        sps.pic_width_in_luma_samples.0 = 0;
+        for input in inputs {
+            sps.pic_width_in_luma_samples.0 += input.sps.pic_width_in_luma_samples.0;
+        }
+
+        let input_0_pps = inputs[0].pps.clone();
+        let mut pps = input_0_pps.clone();
+        pps.tiles_enabled_flag.0 = 1;
+        pps.num_tile_columns_minus1.0 = inputs.len() as u64 - 1;
+        pps.uniform_spacing_flag.0 = 1;
+
+        let mut buf = Vec::new();
+        sps.encode(&mut BitstreamWriter::new(&mut buf))?;
+        let sps_payload = EmulationPrevention::new(buf).collect();
+        let mut buf = Vec::new();
+        pps.encode(&mut BitstreamWriter::new(&mut buf))?;
+        let pps_payload = EmulationPrevention::new(buf).collect();
+
+        let mut ctb_x = 0;
+        let tile_addresses = inputs[..inputs.len() - 1]
+            .iter()
+            .map(|input| {
+                ctb_x += input.sps.PicWidthInCtbsY();
+                ctb_x
+            })
+            .collect();
+
+        Ok(Self {
+            input_0_sps,
+            input_0_pps,
+            sps,
+            pps,
+            sps_payload,
+            pps_payload,
+            tile_addresses,
+        })
+    }
+
+    // Writes the start code, NALU header, and escaped slice segment header of a joined slice segment.
+    fn write_slice_segment_prefix(&self, buf: &mut Vec<u8>, scratch: &mut Vec<u8>, nalu_header: &NALUnitHeader, header: &SliceSegmentHeader) -> io::Result<()> {
+        buf.extend_from_slice(&[0, 0, 0, 1]);
+        nalu_header.encode(&mut BitstreamWriter::new(&mut *buf))?;
+        scratch.clear();
+        header.encode(&mut BitstreamWriter::new(&mut *scratch), nalu_header.nal_unit_type.0, &self.sps, &self.pps)?;
+        buf.extend(&mut EmulationPrevention::new(scratch.iter().copied()));
+        Ok(())
+    }
+
+    // Converts a NALU from the first input into the corresponding unit of output. Slice segment
+    // headers are written to buffers from `recycled` when possible.
+    fn output_unit<'a, T: AsRef<[u8]>>(&'a self, nalu: T, recycled: &mpsc::Receiver<Vec<Vec<u8>>>, scratch: &mut Vec<u8>) -> io::Result<OutputUnit<'a, T>> {
+        let mut bs = Bitstream::new(nalu.as_ref().iter().copied());
+        let nalu_header = NALUnitHeader::decode(&mut bs)?;
+
+        Ok(match nalu_header.nal_unit_type.0 {
+            h265::NAL_UNIT_TYPE_SPS_NUT => OutputUnit::ParameterSet(nalu_header, &self.sps_payload),
+            h265::NAL_UNIT_TYPE_PPS_NUT => OutputUnit::ParameterSet(nalu_header, &self.pps_payload),
+            1..=9 | 16..=21 => {
+                let mut segment = SliceSegment::decode(nalu.as_ref(), &self.input_0_sps, &self.input_0_pps)?;
+                let mut headers = recycled.try_recv().unwrap_or_else(|_| vec![Vec::new(); self.tile_addresses.len() + 1]);
+                headers[0].clear();
+                self.write_slice_segment_prefix(&mut headers[0], scratch, &nalu_header, &segment.header)?;
+                for (buf, &ctb_x) in headers[1..].iter_mut().zip(&self.tile_addresses) {
+                    segment.header.first_slice_segment_in_pic_flag.0 = 0;
+                    segment.header.slice_segment_address = ctb_x;
+                    buf.clear();
+                    self.write_slice_segment_prefix(buf, scratch, &nalu_header, &segment.header)?;
+                }
+                OutputUnit::SliceSegment {
+                    headers,
+                    nalu,
+                    data_offset: segment.data_offset,
+                }
+            }
+            _ => OutputUnit::NALUnit(nalu),
+        })
+    }
+}
+
+// A unit of output produced by the first input's worker.
+enum OutputUnit<'a, T> {
+    // a NALU that is written as-is
+    NALUnit(T),
+    // a parameter set NALU, which is replaced by the joined one
+    ParameterSet(NALUnitHeader, &'a [u8]),
+    // a slice segment, which is written with the rewritten headers of every tile. the headers are
+    // complete with start codes and the first tile's data is taken from the NALU
+    SliceSegment { headers: Vec<Vec<u8>>, nalu: T, data_offset: usize },
+}
+
+// A slice segment whose header has been decoded. The slice segment data is left where it is so that
+// it can be written out as-is, emulation prevention bytes and all.
+struct SliceSegment {
+    header: SliceSegmentHeader,
+    // the offset of the slice segment data within the NALU
+    data_offset: usize,
+}
+
+impl SliceSegment {
+    fn decode(nalu: &[u8], sps: &SequenceParameterSet, pps: &PictureParameterSet) -> io::Result<Self> {
+        let mut bs = Bitstream::new(nalu.iter().copied());
+        let nalu_header = NALUnitHeader::decode(&mut bs)?;
+        let mut rbsp = RBSP::new(bs.into_inner());
+        let header = SliceSegmentHeader::decode(&mut Bitstream::new(&mut rbsp), nalu_header.nal_unit_type.0, sps, pps)?;
+        // the header ends byte aligned, and the bitstream never reads past it
+        let data_offset = nalu.len() - rbsp.into_inner().len();
+        Ok(Self { header, data_offset })
+    }
+}
+
 struct Input<Iter, T> {
     skipped_nalus: VecDeque<T>,
     nalus: Iter,
@@ -182,4 +361,87 @@ impl<T: AsRef<[u8]>, Iter: Iterator<Item = Result<T, E>>, E: From<io::Error>> In
         });
         Some(Ok(self.current_nalu.as_ref().expect("we just set this").as_ref()))
     }
+
+    fn into_nalus(self) -> impl Iterator<Item = Result<T, E>> {
+        self.skipped_nalus.into_iter().map(Ok).chain(self.nalus)
+    }
+
+    // Sends each of the remaining slice segments to the output along with the offset of its data.
+    fn send_slice_segment_data(self, params: &JoinedParameterSets, tx: mpsc::SyncSender<Result<(T, usize), E>>) {
+        for nalu in self.into_nalus() {
+            let segment = nalu.and_then(|nalu| {
+                let mut bs = Bitstream::new(nalu.as_ref().iter().copied());
+                Ok(match NALUnitHeader::decode(&mut bs)?.nal_unit_type.0 {
+                    1..=9 | 16..=21 => {
+                        let data_offset = SliceSegment::decode(nalu.as_ref(), &params.input_0_sps, &params.input_0_pps)?.data_offset;
+                        Some((nalu, data_offset))
+                    }
+                    _ => None,
+                })
+            });
+            let failed = segment.is_err();
+            if let Some(segment) = segment.transpose() {
+                if tx.send(segment).is_err() || failed {
+                    return;
+                }
+            }
+        }
+    }
+
+    // Sends each of the remaining NALUs to the output, rewritten for the joined stream.
+    fn send_output_units<'a>(
+        self,
+        params: &'a JoinedParameterSets,
+        tx: mpsc::SyncSender<Result<OutputUnit<'a, T>, E>>,
+        recycled: mpsc::Receiver<Vec<Vec<u8>>>,
+    ) {
+        let mut scratch = Vec::new();
+        for nalu in self.into_nalus() {
+            let unit = nalu.and_then(|nalu| Ok(params.output_unit(nalu, &recycled, &mut scratch)?));
+            let failed = unit.is_err();
+            if tx.send(unit).is_err() || failed {
+                return;
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    include!(concat!(env!("CARGO_MANIFEST_DIR"), "/../h265/testdata/sample.rs"));
+
+    #[test]
+    fn test_join_parallel() {
+        let data = read_sample();
+        let nalus = sample_nalus(&data);
+
+        for n in 1..=4 {
+            let inputs = || (0..n).map(|_| nalus.iter().map(|&nalu| Ok::<_, io::Error>(nalu)));
+            let mut expected = vec![];
+            join(inputs(), &mut expected).unwrap();
+            let mut actual = vec![];
+            join_parallel(inputs(), &mut actual).unwrap();
+            assert_eq!(actual, expected, "{} inputs", n);
+
+            let mut sps = None;
+            for nalu in h265::iterate_annex_b(&actual) {
+                if (nalu[0] >> 1) & 0x3f == h265::NAL_UNIT_TYPE_SPS_NUT {
+                    let mut nalu = NALUnit::decode(Bitstream::new(nalu.iter().copied())).unwrap();
+                    sps = Some(SequenceParameterSet::decode(&mut Bitstream::new(&mut nalu.rbsp_byte)).unwrap());
+                }
+            }
+            assert_eq!(sps.unwrap().pic_width_in_luma_samples.0, 1280 * n);
+        }
+
+        // the second input runs out of slice segments
+        let inputs = || {
+            vec![&nalus[..], &nalus[..nalus.len() - 1]]
+                .into_iter()
+                .map(|nalus| nalus.iter().map(|&nalu| Ok::<_, io::Error>(nalu)))
+        };
+        assert_eq!(join(inputs(), io::sink()).unwrap_err().kind(), io::ErrorKind::UnexpectedEof);
+        assert_eq!(join_parallel(inputs(), io::sink()).unwrap_err().kind(), io::ErrorKind::UnexpectedEof);
+    }
 }
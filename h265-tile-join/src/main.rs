@@ -31,7 +31,7 @@ fn main() -> Result<(), BoxError> {
 
     let output = File::create(matches.value_of("output").unwrap())?;
 
-    join(inputs.into_iter().map(h265::read_annex_b), output)?;
+    join_parallel(inputs.into_iter().map(h265::read_annex_b), output)?;
 
     Ok(())
 }
@@ -0,0 +1,40 @@
+//! Benchmarks muxing increasing numbers of inputs, each a copy of the xilinx crate's test video
+//! read from an Annex B stream as the command line tool does.
+//!
+//! The test video is coded with wavefront parallel processing rather than tiles, so its 12
+//! substreams are selected from the inputs in turn instead.
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+const INPUT_COUNTS: &[usize] = &[1, 2, 4, 8, 16];
+const SUBSTREAMS: usize = 12;
+
+include!(concat!(env!("CARGO_MANIFEST_DIR"), "/../h265/testdata/sample.rs"));
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let input = sample_annex_b();
+    let mut output = Vec::new();
+
+    let mut g = c.benchmark_group("mux");
+    g.sample_size(10);
+    for &inputs in INPUT_COUNTS {
+        let selection = (0..SUBSTREAMS).map(|i| i % inputs).collect::<Vec<_>>();
+        g.throughput(Throughput::Bytes((input.len() * inputs) as u64));
+        g.bench_with_input(BenchmarkId::new("mux", inputs), &inputs, |b, &inputs| {
+            b.iter(|| {
+                output.clear();
+                h265_tile_mux::mux((0..inputs).map(|_| h265::read_annex_b(&input[..])), &selection, &mut output).unwrap();
+            })
+        });
+        g.bench_with_input(BenchmarkId::new("mux_parallel", inputs), &inputs, |b, &inputs| {
+            b.iter(|| {
+                output.clear();
+                h265_tile_mux::mux_parallel((0..inputs).map(|_| h265::read_annex_b(&input[..])), &selection, &mut output).unwrap();
+            })
+        });
+    }
+    g.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
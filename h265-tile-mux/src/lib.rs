@@ -1,57 +1,103 @@
 use h265::{
     Bitstream, BitstreamWriter, Decode, EmulationPrevention, Encode, NALUnit, NALUnitHeader, PictureParameterSet, SequenceParameterSet, SliceSegmentHeader,
+    RBSP,
 };
-use std::io::{self, Write};
+use std::{
+    io::{self, Write},
+    sync::{mpsc, Arc},
+    thread,
+};
+
+// The number of slice segments each input's worker may get ahead of the output. This bounds the
+// memory used by mux_parallel regardless of input length.
+const PIPELINE_DEPTH: usize = 8;
 
 /// Given an iterator for slice NALUs that are known to correspond to the same frame, writes out
 /// the muxed slice NALU. The output will not contain a length prefix or start code.
-pub fn mux_slices<I, T, O>(nalus: I, selection: &[usize], mut output: O, sps: &SequenceParameterSet, pps: &PictureParameterSet) -> io::Result<()>
+pub fn mux_slices<I, T, O>(nalus: I, selection: &[usize], output: O, sps: &SequenceParameterSet, pps: &PictureParameterSet) -> io::Result<()>
 where
     I: IntoIterator<Item = T>,
     T: AsRef<[u8]>,
     O: Write,
 {
-    struct SliceSegment {
-        nalu_header: NALUnitHeader,
-        header: SliceSegmentHeader,
-        tile_data: Vec<u8>,
-        tiles: Vec<(usize, usize)>,
-    }
-
     // gather all the slice segments
     let mut segments = nalus
         .into_iter()
-        .map(|nalu| -> io::Result<_> {
+        .map(|nalu| SliceSegment::decode(nalu, sps, pps, Vec::new()))
+        .collect::<io::Result<Vec<_>>>()?;
+
+    write_muxed_slice_segment(output, &mut segments, selection, sps, pps, &mut Vec::new(), &mut Vec::new())
+}
+
+// A slice segment whose header has been decoded. The tiles are left where they are in the NALU so
+// that they can be written out as-is, emulation prevention bytes and all.
+struct SliceSegment<T> {
+    nalu: T,
+    nalu_header: NALUnitHeader,
+    header: SliceSegmentHeader,
+    // the offset and length of each tile within the NALU
+    tiles: Vec<(usize, usize)>,
+}
+
+impl<T: AsRef<[u8]>> SliceSegment<T> {
+    // Decodes the slice segment, reusing `tiles` for the tile locations.
+    fn decode(nalu: T, sps: &SequenceParameterSet, pps: &PictureParameterSet, mut tiles: Vec<(usize, usize)>) -> io::Result<Self> {
+        let (nalu_header, header) = {
+            let data = nalu.as_ref();
+
             // parse the header
-            let bs = Bitstream::new(nalu.as_ref().iter().copied());
-            let mut nalu = NALUnit::decode(bs)?;
-            let header = SliceSegmentHeader::decode(&mut Bitstream::new(&mut nalu.rbsp_byte), nalu.nal_unit_header.nal_unit_type.0, sps, pps)?;
-            let mut tile_data = nalu.rbsp_byte.into_inner().collect::<Vec<u8>>();
+            let mut bs = Bitstream::new(data.iter().copied());
+            let nalu_header = NALUnitHeader::decode(&mut bs)?;
+            let mut rbsp = RBSP::new(bs.into_inner());
+            let header = SliceSegmentHeader::decode(&mut Bitstream::new(&mut rbsp), nalu_header.nal_unit_type.0, sps, pps)?;
+
+            // the header ends byte aligned, and the bitstream never reads past it
+            let mut offset = data.len() - rbsp.into_inner().len();
+            let mut tile_data = &data[offset..];
 
             // drop any cabac_zero_words
             while tile_data.ends_with(&[0, 0, 3]) {
-                tile_data.truncate(tile_data.len() - 3);
+                tile_data = &tile_data[..tile_data.len() - 3];
             }
+            let tile_data_end = offset + tile_data.len();
 
             // collect the tile offsets
-            let mut tiles: Vec<(usize, usize)> = Vec::new();
-            let mut offset: usize = 0;
+            tiles.clear();
             for entry_offset in &header.entry_point_offset_minus1 {
                 let end = offset + *entry_offset as usize + 1;
                 tiles.push((offset, end - offset));
                 offset = end;
             }
-            tiles.push((offset, tile_data.len() - offset));
-
-            Ok(SliceSegment {
-                header,
-                nalu_header: nalu.nal_unit_header,
-                tiles,
-                tile_data,
-            })
+            tiles.push((offset, tile_data_end - offset));
+
+            (nalu_header, header)
+        };
+
+        Ok(Self {
+            nalu,
+            nalu_header,
+            header,
+            tiles,
         })
-        .collect::<Result<Vec<SliceSegment>, _>>()?;
+    }
 
+    fn tile(&self, tile: usize) -> &[u8] {
+        let (offset, len) = self.tiles[tile];
+        &self.nalu.as_ref()[offset..offset + len]
+    }
+}
+
+// Writes out the NALU muxed from the given slice segments. The first segment's header is updated to
+// become the muxed one, and `buf` and `scratch` are used to encode it.
+fn write_muxed_slice_segment<T: AsRef<[u8]>, O: Write>(
+    mut output: O,
+    segments: &mut [SliceSegment<T>],
+    selection: &[usize],
+    sps: &SequenceParameterSet,
+    pps: &PictureParameterSet,
+    buf: &mut Vec<u8>,
+    scratch: &mut Vec<u8>,
+) -> io::Result<()> {
     // update the entry points in the header
     for tile in 0..segments[0].header.num_entry_point_offsets.0 as usize {
         segments[0].header.offset_len_minus1.0 = segments[0].header.offset_len_minus1.0.max(segments[selection[tile]].header.offset_len_minus1.0);
@@ -60,17 +106,16 @@ where
 
     // write out the new nalu
     let nalu_header = &segments[0].nalu_header;
-    nalu_header.encode(&mut BitstreamWriter::new(&mut output))?;
-    let mut buf = Vec::new();
+    buf.clear();
+    nalu_header.encode(&mut BitstreamWriter::new(&mut *buf))?;
+    scratch.clear();
     segments[0]
         .header
-        .encode(&mut BitstreamWriter::new(&mut buf), nalu_header.nal_unit_type.0, sps, pps)?;
-    let buf = EmulationPrevention::new(buf).collect::<Vec<u8>>();
-    output.write_all(&buf)?;
+        .encode(&mut BitstreamWriter::new(&mut *scratch), nalu_header.nal_unit_type.0, sps, pps)?;
+    buf.extend(&mut EmulationPrevention::new(scratch.iter().copied()));
+    output.write_all(buf)?;
     for tile in 0..segments[0].header.num_entry_point_offsets.0 as usize + 1 {
-        let selection = &segments[selection[tile]];
-        let (offset, len) = selection.tiles[tile];
-        output.write_all(&selection.tile_data[offset..offset + len])?;
+        output.write_all(segments[selection[tile]].tile(tile))?;
     }
 
     Ok(())
@@ -87,14 +132,7 @@ where
     Iter: Iterator<Item = Result<T, E>>,
     O: Write,
 {
-    let mut inputs: Vec<_> = inputs
-        .into_iter()
-        .map(|input| Input {
-            nalus: input.into_iter(),
-            pps: None,
-            sps: None,
-        })
-        .collect();
+    let mut inputs: Vec<_> = inputs.into_iter().map(|input| Input::new(input.into_iter())).collect();
 
     while let Some(nalu) = inputs[0].next_nalu().transpose()? {
         let mut bs = Bitstream::new(nalu.as_ref().iter().copied());
@@ -130,13 +168,118 @@ where
     Ok(())
 }
 
+/// Like `mux`, but parses each input on its own thread.
+///
+/// Each worker decodes its input's slice segment headers and locates the tiles within them, using
+/// the parameter sets that are active in the first input at the time. The muxed NALUs are written
+/// on the calling thread in frame order, with the tiles taken directly from the input NALUs. Each
+/// worker stays at most a few slice segments ahead of the output.
+pub fn mux_parallel<I, II, T, E, Iter, O>(inputs: II, selection: &[usize], mut output: O) -> Result<(), E>
+where
+    E: From<io::Error> + Send,
+    T: AsRef<[u8]> + Send,
+    I: IntoIterator<Item = Result<T, E>, IntoIter = Iter>,
+    II: IntoIterator<Item = I>,
+    Iter: Iterator<Item = Result<T, E>> + Send,
+    O: Write,
+{
+    thread::scope(|s| -> Result<(), E> {
+        let mut inputs = inputs.into_iter().map(|input| Input::new(input.into_iter()));
+        let input_0 = inputs.next().expect("at least one input is required");
+
+        let mut workers = Vec::new();
+        let mut parameter_sets = Vec::new();
+        for (i, input) in inputs.enumerate() {
+            let (parameter_sets_tx, parameter_sets_rx) = mpsc::sync_channel(PIPELINE_DEPTH);
+            let (tx, rx) = mpsc::sync_channel(PIPELINE_DEPTH);
+            let (recycled_tx, recycled_rx) = mpsc::sync_channel(PIPELINE_DEPTH);
+            spawn_worker(s, i + 1, move || input.send_slice_segments(parameter_sets_rx, tx, recycled_rx))?;
+            parameter_sets.push(parameter_sets_tx);
+            workers.push(Worker {
+                segments: rx,
+                recycled: recycled_tx,
+            });
+        }
+
+        let (tx, rx) = mpsc::sync_channel(PIPELINE_DEPTH);
+        let (recycled_tx, recycled_rx) = mpsc::sync_channel(PIPELINE_DEPTH);
+        spawn_worker(s, 0, move || input_0.send_nalus(parameter_sets, tx, recycled_rx))?;
+
+        let mut segments = Vec::with_capacity(workers.len() + 1);
+        let mut buf = Vec::new();
+        let mut scratch = Vec::new();
+        for unit in rx {
+            match unit? {
+                OutputUnit::NALUnit(nalu) => {
+                    output.write_all(&[0, 0, 0, 1])?;
+                    output.write_all(nalu.as_ref())?;
+                }
+                OutputUnit::SliceSegment(segment, (sps, pps)) => {
+                    segments.push(segment);
+                    for worker in &workers {
+                        match worker.segments.recv() {
+                            Ok(segment) => segments.push(segment?),
+                            Err(_) => {
+                                return Err(io::Error::new(io::ErrorKind::Other, "input streams do not have the same number of slice segment nalus").into())
+                            }
+                        }
+                    }
+
+                    output.write_all(&[0, 0, 0, 1])?;
+                    write_muxed_slice_segment(&mut output, &mut segments, selection, &sps, &pps, &mut buf, &mut scratch)?;
+
+                    // if a worker already has enough spare tile lists, these are just dropped
+                    let mut segments = segments.drain(..);
+                    if let Some(segment) = segments.next() {
+                        let _ = recycled_tx.try_send(segment.tiles);
+                    }
+                    for (worker, segment) in workers.iter().zip(segments) {
+                        let _ = worker.recycled.try_send(segment.tiles);
+                    }
+                }
+            }
+        }
+
+        Ok(())
+    })
+}
+
+fn spawn_worker<'scope, 'env, F>(s: &'scope thread::Scope<'scope, 'env>, input: usize, f: F) -> io::Result<()>
+where
+    F: FnOnce() + Send + 'scope,
+{
+    thread::Builder::new().name(format!("h265-tile-mux-{}", input)).spawn_scoped(s, f)?;
+    Ok(())
+}
+
+type ParameterSets = (Arc<SequenceParameterSet>, Arc<PictureParameterSet>);
+
+// A unit of output produced by the first input's worker.
+#[allow(clippy::large_enum_variant)] // units are only moved once, from the worker to the output.
+enum OutputUnit<T> {
+    // a NALU that is written as-is
+    NALUnit(T),
+    // a slice segment that is muxed with the other inputs' slice segments
+    SliceSegment(SliceSegment<T>, ParameterSets),
+}
+
+// The calling thread's ends of the channels for one of the other inputs' workers.
+struct Worker<T, E> {
+    segments: mpsc::Receiver<Result<SliceSegment<T>, E>>,
+    recycled: mpsc::SyncSender<Vec<(usize, usize)>>,
+}
+
 struct Input<Iter> {
     nalus: Iter,
-    pps: Option<PictureParameterSet>,
-    sps: Option<SequenceParameterSet>,
+    pps: Option<Arc<PictureParameterSet>>,
+    sps: Option<Arc<SequenceParameterSet>>,
 }
 
 impl<T: AsRef<[u8]>, Iter: Iterator<Item = Result<T, E>>, E: From<io::Error>> Input<Iter> {
+    fn new(nalus: Iter) -> Self {
+        Self { nalus, pps: None, sps: None }
+    }
+
     fn next_nalu(&mut self) -> Option<Result<T, E>> {
         Some(match self.nalus.next()? {
             Ok(b) => self.inspect_nalu(b.as_ref()).map(|_| b).map_err(|e| e.into()),
@@ -168,15 +311,130 @@ impl<T: AsRef<[u8]>, Iter: Iterator<Item = Result<T, E>>, E: From<io::Error>> In
             h265::NAL_UNIT_TYPE_PPS_NUT => {
                 let mut rbsp = Bitstream::new(&mut nalu.rbsp_byte);
                 let pps = PictureParameterSet::decode(&mut rbsp)?;
-                self.pps = Some(pps);
+                self.pps = Some(Arc::new(pps));
             }
             h265::NAL_UNIT_TYPE_SPS_NUT => {
                 let mut rbsp = Bitstream::new(&mut nalu.rbsp_byte);
                 let sps = SequenceParameterSet::decode(&mut rbsp)?;
-                self.sps = Some(sps);
+                self.sps = Some(Arc::new(sps));
             }
             _ => {}
         }
         Ok(nalu.nal_unit_header)
     }
+
+    // Sends each of the first input's NALUs to the output. The parameter sets for each slice
+    // segment are sent to the other inputs' workers first, so that they can decode theirs.
+    fn send_nalus(
+        mut self,
+        parameter_sets: Vec<mpsc::SyncSender<ParameterSets>>,
+        tx: mpsc::SyncSender<Result<OutputUnit<T>, E>>,
+        recycled: mpsc::Receiver<Vec<(usize, usize)>>,
+    ) {
+        while let Some(nalu) = self.next_nalu() {
+            let unit = nalu.and_then(|nalu| {
+                let mut bs = Bitstream::new(nalu.as_ref().iter().copied());
+                Ok(match NALUnitHeader::decode(&mut bs)?.nal_unit_type.0 {
+                    1..=9 | 16..=21 => match (&self.sps, &self.pps) {
+                        (Some(sps), Some(pps)) => {
+                            for tx in &parameter_sets {
+                                // if a worker has stopped, the output will find out when it needs its next segment
+                                let _ = tx.send((sps.clone(), pps.clone()));
+                            }
+                            let segment = SliceSegment::decode(nalu, sps, pps, recycled.try_recv().unwrap_or_default())?;
+                            Some(OutputUnit::SliceSegment(segment, (sps.clone(), pps.clone())))
+                        }
+                        // we can't do anything until we get the pps and sps
+                        _ => None,
+                    },
+                    _ => Some(OutputUnit::NALUnit(nalu)),
+                })
+            });
+            let failed = unit.is_err();
+            if let Some(unit) = unit.transpose() {
+                if tx.send(unit).is_err() || failed {
+                    return;
+                }
+            }
+        }
+    }
+
+    // Sends each of the input's slice segments to the output, decoded with the parameter sets
+    // received from the first input's worker.
+    fn send_slice_segments(
+        mut self,
+        parameter_sets: mpsc::Receiver<ParameterSets>,
+        tx: mpsc::SyncSender<Result<SliceSegment<T>, E>>,
+        recycled: mpsc::Receiver<Vec<(usize, usize)>>,
+    ) {
+        while let Some(nalu) = self.next_slice_segment() {
+            let segment = nalu.and_then(|nalu| {
+                let (sps, pps) = match parameter_sets.recv() {
+                    Ok(parameter_sets) => parameter_sets,
+                    // the first input has no more slice segments
+                    Err(_) => return Ok(None),
+                };
+                Ok(Some(SliceSegment::decode(nalu, &sps, &pps, recycled.try_recv().unwrap_or_default())?))
+            });
+            let failed = segment.is_err();
+            match segment.transpose() {
+                Some(segment) => {
+                    if tx.send(segment).is_err() || failed {
+                        return;
+                    }
+                }
+                None => return,
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    // The sample is coded with wavefront parallel processing, so each slice segment has a substream
+    // for each of its 12 rows of CTBs.
+    const SUBSTREAMS: usize = 12;
+
+    include!(concat!(env!("CARGO_MANIFEST_DIR"), "/../h265/testdata/sample.rs"));
+
+    // Returns the sample's NALUs starting from the given random access point.
+    fn rotated_sample_nalus(data: &[u8], start: usize) -> Vec<&[u8]> {
+        let nalus = sample_nalus(data);
+        let start = nalus
+            .iter()
+            .filter(|nalu| (nalu[0] >> 1) & 0x3f == h265::NAL_UNIT_TYPE_VPS_NUT)
+            .nth(start)
+            .unwrap();
+        let start = nalus.iter().position(|nalu| nalu.as_ptr() == start.as_ptr()).unwrap();
+        nalus[start..].iter().chain(&nalus[..start]).copied().collect()
+    }
+
+    #[test]
+    fn test_mux_parallel() {
+        let data = read_sample();
+
+        for n in 1..=4 {
+            let sources = (0..n).map(|i| rotated_sample_nalus(&data, i)).collect::<Vec<_>>();
+            let inputs = || sources.iter().map(|nalus| nalus.iter().map(|&nalu| Ok::<_, io::Error>(nalu)));
+            let selection = (0..SUBSTREAMS).map(|i| (i * 3 + 1) % n).collect::<Vec<_>>();
+            let mut expected = vec![];
+            mux(inputs(), &selection, &mut expected).unwrap();
+            let mut actual = vec![];
+            mux_parallel(inputs(), &selection, &mut actual).unwrap();
+            assert_eq!(actual, expected, "{} inputs", n);
+        }
+
+        // the second input runs out of slice segments
+        let nalus = sample_nalus(&data);
+        let inputs = || {
+            vec![&nalus[..], &nalus[..nalus.len() - 1]]
+                .into_iter()
+                .map(|nalus| nalus.iter().map(|&nalu| Ok::<_, io::Error>(nalu)))
+        };
+        let selection = [0, 1].repeat(SUBSTREAMS / 2);
+        assert!(mux(inputs(), &selection, io::sink()).is_err());
+        assert!(mux_parallel(inputs(), &selection, io::sink()).is_err());
+    }
 }
@@ -53,7 +53,7 @@ fn main() -> Result<(), BoxError> {
 
     let output = File::create(matches.value_of("output").unwrap())?;
 
-    mux(inputs.into_iter().map(h265::read_annex_b), &selection, output)?;
+    mux_parallel(inputs.into_iter().map(h265::read_annex_b), &selection, output)?;
 
     Ok(())
 }
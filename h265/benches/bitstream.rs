@@ -0,0 +1,75 @@
+//! Benchmarks parameter set and slice segment header parsing with the iterator-backed and
+//! slice-backed bitstream readers.
+
+use criterion::{criterion_group, criterion_main, Criterion};
+use h265::{Bitstream, Decode, PictureParameterSet, RBSPIter, SequenceParameterSet, SliceSegmentHeader, VideoParameterSet, RBSP};
+use std::{iter::Copied, slice::Iter};
+
+fn iterator_bitstream(payload: &[u8]) -> Bitstream<RBSPIter<Copied<Iter<'_, u8>>>> {
+    Bitstream::new(RBSP::new(payload.iter().copied()))
+}
+
+// Decodes every VPS, SPS, PPS, and slice segment header in `nalus`, constructing each RBSP
+// bitstream from the NAL unit payload with `$bitstream`. Returns the number of decoded syntax
+// structures.
+macro_rules! parse_nalus {
+    ($nalus:expr, $bitstream:expr) => {{
+        let mut sps = None;
+        let mut pps = None;
+        let mut decoded = 0;
+        for nalu in $nalus {
+            let nal_unit_type = (nalu[0] >> 1) & 0x3f;
+            let payload = &nalu[2..];
+            match nal_unit_type {
+                0..=9 | 16..=21 => {
+                    if let (Some(sps), Some(pps)) = (&sps, &pps) {
+                        // some slice segment headers use syntax that isn't supported yet
+                        if SliceSegmentHeader::decode(&mut $bitstream(payload), nal_unit_type, sps, pps).is_ok() {
+                            decoded += 1;
+                        }
+                    }
+                }
+                h265::NAL_UNIT_TYPE_VPS_NUT => {
+                    VideoParameterSet::decode(&mut $bitstream(payload)).unwrap();
+                    decoded += 1;
+                }
+                h265::NAL_UNIT_TYPE_SPS_NUT => {
+                    sps = Some(SequenceParameterSet::decode(&mut $bitstream(payload)).unwrap());
+                    decoded += 1;
+                }
+                h265::NAL_UNIT_TYPE_PPS_NUT => {
+                    pps = Some(PictureParameterSet::decode(&mut $bitstream(payload)).unwrap());
+                    decoded += 1;
+                }
+                _ => {}
+            }
+        }
+        decoded
+    }};
+}
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let buf = std::fs::read("../xilinx/src/testdata/hvc1.1.6.L150.90.h265").unwrap();
+    let nalus = h265::iterate_annex_b(&buf).filter(|nalu| nalu.len() > 2).collect::<Vec<_>>();
+    let expected = parse_nalus!(&nalus, iterator_bitstream);
+
+    let mut g = c.benchmark_group("bitstream");
+    g.throughput(criterion::Throughput::Elements(expected as u64));
+    g.bench_function("iterator", |b| {
+        b.iter(|| {
+            assert_eq!(parse_nalus!(&nalus, iterator_bitstream), expected);
+        });
+    });
+    g.bench_function("slice", |b| {
+        b.iter(|| {
+            assert_eq!(parse_nalus!(&nalus, Bitstream::from_slice), expected);
+        });
+    });
+    g.warm_up_time(std::time::Duration::from_secs(1));
+    g.sampling_mode(criterion::SamplingMode::Flat);
+    g.sample_size(10);
+    g.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
@@ -26,7 +26,7 @@ pub use video_parameter_set::*;
 pub mod syntax_elements;
 pub use syntax_elements::*;
 
-pub use h264::{iterate_annex_b, iterate_avcc, read_annex_b, ReadAnnexB};
+pub use h264::{iterate_annex_b, iterate_avcc, read_annex_b, AnnexBScanner, ReadAnnexB};
 
 #[derive(Clone)]
 pub struct AccessUnitCounter {
@@ -62,9 +62,7 @@ impl AccessUnitCounter {
         match header.nal_unit_type.0 {
             0..=9 | 16..=21 => {
                 if self.maybe_start_new_access_unit {
-                    let bs = Bitstream::new(nalu.iter().copied());
-                    let mut nalu = NALUnit::decode(bs)?;
-                    let mut rbsp = Bitstream::new(&mut nalu.rbsp_byte);
+                    let mut rbsp = Bitstream::from_slice(&nalu[2..]);
                     let first_slice_segment_in_pic_flag = U1::decode(&mut rbsp)?;
                     if first_slice_segment_in_pic_flag.0 != 0 {
                         self.count += 1;
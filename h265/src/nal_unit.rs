@@ -1,5 +1,5 @@
-use super::{decode, encode, syntax_elements::*, Bitstream, BitstreamWriter, Decode, Encode};
-pub use h264::{EmulationPrevention, RBSP};
+use super::{decode, encode, syntax_elements::*, Bitstream, BitstreamSource, BitstreamWriter, Decode, Encode};
+pub use h264::{EmulationPrevention, RBSPIter, RBSP};
 use std::io;
 
 pub const NAL_UNIT_TYPE_TRAIL_N: u8 = 0;
@@ -68,7 +68,7 @@ pub struct NALUnitHeader {
 }
 
 impl Decode for NALUnitHeader {
-    fn decode<T: Iterator<Item = u8>>(bs: &mut Bitstream<T>) -> io::Result<Self> {
+    fn decode<T: BitstreamSource>(bs: &mut Bitstream<T>) -> io::Result<Self> {
         let mut ret = Self::default();
 
         decode!(
@@ -1,4 +1,4 @@
-use super::{decode, encode, syntax_elements::*, Bitstream, BitstreamWriter, Decode, Encode};
+use super::{decode, encode, syntax_elements::*, Bitstream, BitstreamSource, BitstreamWriter, Decode, Encode};
 use std::io;
 
 #[derive(Clone, Debug, Default)]
@@ -20,7 +20,7 @@ pub struct ProfileTierLevel {
 }
 
 impl ProfileTierLevel {
-    pub fn decode<T: Iterator<Item = u8>>(bs: &mut Bitstream<T>, profile_present_flag: u8, max_num_sub_layers_minus1: u8) -> io::Result<Self> {
+    pub fn decode<T: BitstreamSource>(bs: &mut Bitstream<T>, profile_present_flag: u8, max_num_sub_layers_minus1: u8) -> io::Result<Self> {
         let mut ret = Self::default();
 
         if profile_present_flag != 0 {
@@ -1,5 +1,6 @@
 use super::{
-    decode, encode, nal_unit::*, syntax_elements::*, Bitstream, BitstreamWriter, Decode, Encode, PictureParameterSet, SequenceParameterSet, ShortTermRefPicSet,
+    decode, encode, nal_unit::*, syntax_elements::*, Bitstream, BitstreamSource, BitstreamWriter, Decode, Encode, PictureParameterSet, SequenceParameterSet,
+    ShortTermRefPicSet,
 };
 use std::io;
 
@@ -28,7 +29,7 @@ fn ceil_log2(n: u64) -> u32 {
 }
 
 impl RefPicListsModification {
-    pub fn decode<T: Iterator<Item = u8>>(
+    pub fn decode<T: BitstreamSource>(
         bs: &mut Bitstream<T>,
         slice_type: u64,
         #[allow(non_snake_case)] NumPicTotalCurr: u64,
@@ -205,7 +206,7 @@ pub struct SliceSegmentHeader {
 impl SliceSegmentHeader {
     // TODO: pps should probably be a map so we can find the correct pps based on slice_pic_parameter_set_id
     #[allow(clippy::cognitive_complexity)]
-    pub fn decode<T: Iterator<Item = u8>>(bs: &mut Bitstream<T>, nal_unit_type: u8, sps: &SequenceParameterSet, pps: &PictureParameterSet) -> io::Result<Self> {
+    pub fn decode<T: BitstreamSource>(bs: &mut Bitstream<T>, nal_unit_type: u8, sps: &SequenceParameterSet, pps: &PictureParameterSet) -> io::Result<Self> {
         if pps.pps_range_extension_flag.0 != 0 {
             return Err(io::Error::new(io::ErrorKind::Other, "the pps range extension is not supported"));
         }
@@ -658,6 +659,13 @@ mod test {
             let mut round_trip = Vec::new();
             ssh.encode(&mut BitstreamWriter::new(&mut round_trip), 1, &sps, &pps).unwrap();
             assert_eq!(round_trip, data);
+
+            let ssh = SliceSegmentHeader::decode(&mut Bitstream::from_slice(&data), 1, &sps, &pps).unwrap();
+            assert_eq!(ssh.num_entry_point_offsets.0, 143);
+
+            let mut round_trip = Vec::new();
+            ssh.encode(&mut BitstreamWriter::new(&mut round_trip), 1, &sps, &pps).unwrap();
+            assert_eq!(round_trip, data);
         }
     }
 
@@ -0,0 +1,24 @@
+// Included by the h265-tile-join and h265-tile-mux tests and benchmarks, which use the xilinx
+// crate's test video as their sample.
+
+fn read_sample() -> Vec<u8> {
+    std::fs::read(concat!(env!("CARGO_MANIFEST_DIR"), "/../xilinx/src/testdata/hvc1.1.6.L150.90.h265")).unwrap()
+}
+
+// Returns the sample's NALUs, minus the trailing pictures. Those use weighted prediction, which
+// slice segment headers can't be decoded with yet.
+fn sample_nalus(data: &[u8]) -> Vec<&[u8]> {
+    h265::iterate_annex_b(data).filter(|nalu| !matches!((nalu[0] >> 1) & 0x3f, 0 | 1)).collect()
+}
+
+// Returns the sample's NALUs re-framed as an Annex B stream. Only the benchmarks use this.
+#[allow(dead_code)]
+fn sample_annex_b() -> Vec<u8> {
+    let data = read_sample();
+    let mut input = vec![];
+    for nalu in sample_nalus(&data) {
+        input.extend_from_slice(&[0, 0, 0, 1]);
+        input.extend_from_slice(nalu);
+    }
+    input
+}
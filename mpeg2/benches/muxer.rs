@@ -0,0 +1,135 @@
+//! Benchmarks muxing synthetic audio and video access units, with output written to memory.
+
+use criterion::{criterion_group, criterion_main, Criterion, Throughput};
+use mpeg2::{
+    interleaving_muxer::InterleavingMuxer,
+    muxer::{Muxer, Packet, StreamConfig},
+};
+use std::{borrow::Cow, time::Duration};
+
+const VIDEO_FRAME_LEN: usize = 20_000;
+const AUDIO_FRAME_LEN: usize = 400;
+const STREAM_FRAME_LEN: usize = 2_000;
+
+/// Returns one second of access units as (is_video, pts) pairs: 60 video frames and 47 audio
+/// frames (1024 samples each at 48kHz), in presentation order.
+fn access_units() -> Vec<(bool, u64)> {
+    let mut ret = (0..60).map(|i| (true, i * 1500)).chain((0..47).map(|i| (false, i * 1920))).collect::<Vec<_>>();
+    ret.sort_by_key(|&(_, pts)| pts);
+    ret
+}
+
+/// Returns one second of access units for the given number of 60fps streams as (stream_index, pts)
+/// pairs. Streams are written up to three frames behind each other, so the interleaving
+/// muxer has to buffer them.
+fn stream_access_units(streams: usize) -> Vec<(usize, u64)> {
+    let mut ret = (0..60u64).flat_map(|i| (0..streams).map(move |s| (s, i * 1500 + s as u64))).collect::<Vec<_>>();
+    ret.sort_by_key(|&(s, pts)| (pts / 1500 + (s % 4) as u64, s));
+    ret
+}
+
+fn video_config() -> StreamConfig {
+    StreamConfig {
+        stream_id: 0xe0,
+        stream_type: 0x1b,
+        data: vec![],
+        unbounded_data_length: true,
+    }
+}
+
+fn audio_config() -> StreamConfig {
+    StreamConfig {
+        stream_id: 0xc0,
+        stream_type: 0x0f,
+        data: vec![],
+        unbounded_data_length: false,
+    }
+}
+
+fn packet(data: &[u8], pts: u64) -> Packet<'_> {
+    Packet {
+        data: Cow::Borrowed(data),
+        random_access_indicator: pts == 0,
+        pts_90khz: Some(pts),
+        ..Default::default()
+    }
+}
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let access_units = access_units();
+    let video_frame = vec![0x5a; VIDEO_FRAME_LEN];
+    let audio_frame = vec![0xa5; AUDIO_FRAME_LEN];
+    let bytes = access_units
+        .iter()
+        .map(|&(is_video, _)| if is_video { VIDEO_FRAME_LEN } else { AUDIO_FRAME_LEN })
+        .sum::<usize>();
+    let mut out = Vec::new();
+
+    let mut group = c.benchmark_group("muxer");
+    group.throughput(Throughput::Bytes(bytes as _));
+    for &batch_size in &[0, 64] {
+        group.bench_function(format!("batch_size={}", batch_size), |b| {
+            b.iter(|| {
+                out.clear();
+                let mut muxer = Muxer::with_batch_size(&mut out, batch_size);
+                let mut video = muxer.new_stream(video_config());
+                let mut audio = muxer.new_stream(audio_config());
+                for &(is_video, pts) in &access_units {
+                    if is_video {
+                        muxer.write(&mut video, packet(&video_frame, pts)).unwrap();
+                    } else {
+                        muxer.write(&mut audio, packet(&audio_frame, pts)).unwrap();
+                    }
+                }
+                muxer.flush().unwrap();
+            })
+        });
+    }
+    group.finish();
+
+    let mut group = c.benchmark_group("interleaving_muxer");
+    group.throughput(Throughput::Bytes(bytes as _));
+    for &batch_size in &[0, 64] {
+        group.bench_function(format!("batch_size={}", batch_size), |b| {
+            b.iter(|| {
+                out.clear();
+                let mut muxer = InterleavingMuxer::with_batch_size(&mut out, Duration::from_millis(100), batch_size);
+                muxer.add_stream(video_config());
+                muxer.add_stream(audio_config());
+                for &(is_video, pts) in &access_units {
+                    if is_video {
+                        muxer.write(0, packet(&video_frame, pts)).unwrap();
+                    } else {
+                        muxer.write(1, packet(&audio_frame, pts)).unwrap();
+                    }
+                }
+                muxer.flush().unwrap();
+            })
+        });
+    }
+    group.finish();
+
+    let stream_frame = vec![0x5a; STREAM_FRAME_LEN];
+    let mut group = c.benchmark_group("interleaving_muxer_streams");
+    for &streams in &[1, 2, 4, 8, 16, 32] {
+        let access_units = stream_access_units(streams);
+        group.throughput(Throughput::Elements(access_units.len() as _));
+        group.bench_function(format!("streams={}", streams), |b| {
+            b.iter(|| {
+                out.clear();
+                let mut muxer = InterleavingMuxer::with_batch_size(&mut out, Duration::from_millis(100), 64);
+                for _ in 0..streams {
+                    muxer.add_stream(video_config());
+                }
+                for &(stream_index, pts) in &access_units {
+                    muxer.write(stream_index, packet(&stream_frame, pts)).unwrap();
+                }
+                muxer.flush().unwrap();
+            })
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
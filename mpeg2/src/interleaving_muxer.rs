@@ -1,8 +1,10 @@
 use super::EncodeError;
 use crate::muxer::{Muxer, Packet, Stream, StreamConfig};
+use crate::temi::TEMITimelineDescriptor;
+use alloc::borrow::Cow;
 use alloc::collections::vec_deque::VecDeque;
 use alloc::vec::Vec;
-use core::time::Duration;
+use core::{mem, time::Duration};
 use core2::io::Write;
 
 const TS_33BIT_MASK: u64 = 0x1FFFFFFFF;
@@ -13,23 +15,88 @@ pub struct InterleavingMuxer<W: Write> {
     largest_ts_in_buffer: u64,
     streams: Vec<InterleavingStream>,
     last_fixed_timestamp: u64,
+
+    /// Tracks the timestamp at the head of each stream's buffer.
+    heads: HeadTree,
+    /// Data buffers from packets that have been written, kept for reuse by packets that need to be
+    /// buffered.
+    buffer_pool: Vec<Vec<u8>>,
+    /// The most packets that have been buffered at once, across all streams. The pool never needs
+    /// to be larger than this.
+    max_buffered_packets: usize,
+    /// The number of packets currently buffered, across all streams.
+    buffered_packets: usize,
+    /// Reused by each write to hold packets that are ready to be written.
+    ready_packets: Vec<(usize, BufferedPacket)>,
+    /// Reused by each write to hold the indices of streams with packets outside the buffer duration.
+    ready_streams: Vec<usize>,
 }
 
 pub struct InterleavingStream {
     inner: Stream,
-    buffered_packets: VecDeque<(usize, u64, Option<Packet<'static>>)>,
+    buffered_packets: VecDeque<BufferedPacket>,
     last_written_ts: u64,
+    stats: InterleavingStreamStats,
+}
+
+/// Statistics for a stream's buffering, which can be used to tune the maximum buffer duration.
+///
+/// Latency is measured in stream time: it's how far the most recent timestamp written to the
+/// muxer advanced while a packet was buffered. Packets that are written immediately have no added
+/// latency.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct InterleavingStreamStats {
+    /// The number of packets currently buffered.
+    pub buffered_packets: usize,
+    /// The most packets that have been buffered at once.
+    pub max_buffered_packets: usize,
+    /// The number of packets that have been written to the inner muxer.
+    pub written_packets: u64,
+    /// The sum of the added latency of all written packets. Divide by written_packets for the mean.
+    pub total_latency_90khz: u64,
+    /// The largest added latency of any written packet.
+    pub max_latency_90khz: u64,
+}
+
+/// A packet waiting in a stream's buffer. Packets without data are placeholders for the packet
+/// currently being written, which isn't copied unless it actually needs to be buffered.
+struct BufferedPacket {
+    ts: u64,
+    largest_ts_when_buffered: u64,
+    packet: Option<OwnedPacket>,
+}
+
+/// The contents of a buffered [`Packet`], with data buffers that can be returned to the pool.
+struct OwnedPacket {
+    data: Vec<u8>,
+    random_access_indicator: bool,
+    pts_90khz: Option<u64>,
+    dts_90khz: Option<u64>,
+    temi_timeline_descriptors: Vec<TEMITimelineDescriptor>,
+    private_data_bytes: Vec<u8>,
 }
 
 impl<W: Write> InterleavingMuxer<W> {
     pub fn new(w: W, max_buffer_duration: Duration) -> Self {
-        let muxer = Muxer::new(w);
+        Self::with_batch_size(w, max_buffer_duration, 0)
+    }
+
+    /// Creates an interleaving muxer whose output is written in batches of at least batch_size
+    /// packets. See [`Muxer::with_batch_size`].
+    pub fn with_batch_size(w: W, max_buffer_duration: Duration, batch_size: usize) -> Self {
+        let muxer = Muxer::with_batch_size(w, batch_size);
         Self {
             inner: muxer,
             max_buffer_duration_90khz: (max_buffer_duration.as_millis() * 90) as u64,
             largest_ts_in_buffer: 0,
             streams: vec![],
             last_fixed_timestamp: 0,
+            heads: HeadTree::new(0),
+            buffer_pool: vec![],
+            max_buffered_packets: 0,
+            buffered_packets: 0,
+            ready_packets: vec![],
+            ready_streams: vec![],
         }
     }
 
@@ -39,8 +106,23 @@ impl<W: Write> InterleavingMuxer<W> {
             inner,
             buffered_packets: VecDeque::new(),
             last_written_ts: 0,
+            stats: InterleavingStreamStats::default(),
         };
         self.streams.push(interleaving_stream);
+
+        self.heads = HeadTree::new(self.streams.len());
+        for (i, stream) in self.streams.iter().enumerate() {
+            self.heads.update(i, stream.buffered_packets.front().map(|p| p.ts));
+        }
+    }
+
+    /// Returns the buffering statistics for the given stream.
+    pub fn stream_stats(&self, stream_index: usize) -> InterleavingStreamStats {
+        let stream = &self.streams[stream_index];
+        InterleavingStreamStats {
+            buffered_packets: stream.buffered_packets.len(),
+            ..stream.stats
+        }
     }
 
     /// This function returns a timestamp with high bits added in order to keep it as close as possible to `last_fixed_timestamp`.
@@ -70,8 +152,8 @@ impl<W: Write> InterleavingMuxer<W> {
         // if the packet doesn't have a dts, use the pts. if it doesn't have a pts, consider it to have the same timestamp as the last packet
         let ts = p.dts_90khz.or(p.pts_90khz).unwrap_or(last_written_ts);
         // if all other streams have provided packets with timestamps after this packet, we can emit it now
-        if ts < self.min_ts_excluding(stream_index) || ts < self.largest_ts_in_buffer.saturating_sub(self.max_buffer_duration_90khz) {
-            self.write_muxer_packet(stream_index, p)?;
+        if ts < self.heads.min_excluding(stream_index) || ts < self.largest_ts_in_buffer.saturating_sub(self.max_buffer_duration_90khz) {
+            self.write_muxer_packet(stream_index, p, 0)?;
             self.streams[stream_index].last_written_ts = ts;
         } else {
             // and then we need to see if this enabled any other streams to emit their outputs
@@ -81,132 +163,173 @@ impl<W: Write> InterleavingMuxer<W> {
         Ok(())
     }
 
-    fn write_muxer_packet(&mut self, stream_index: usize, p: Packet) -> Result<(), EncodeError> {
-        let stream = &mut self.streams[stream_index].inner;
-        self.inner.write(stream, p)?;
+    fn write_muxer_packet(&mut self, stream_index: usize, p: Packet, latency_90khz: u64) -> Result<(), EncodeError> {
+        let stream = &mut self.streams[stream_index];
+        stream.stats.written_packets += 1;
+        stream.stats.total_latency_90khz += latency_90khz;
+        stream.stats.max_latency_90khz = stream.stats.max_latency_90khz.max(latency_90khz);
+        self.inner.write(&mut stream.inner, p)?;
         Ok(())
     }
 
-    fn emit_packets_outside_buffer_duration(&mut self) -> Result<(), EncodeError> {
-        let mut packets = vec![];
-        for (stream_index, stream) in self.streams.iter_mut().enumerate() {
-            while let Some(p) = stream.buffered_packets.front() {
-                let ts = p.1;
-                if self.largest_ts_in_buffer - ts > self.max_buffer_duration_90khz {
-                    packets.push((
-                        stream_index,
-                        ts,
-                        stream.buffered_packets.pop_front().expect("there must be at least one packet to pop"),
-                    ));
-                } else {
-                    break;
+    /// Writes a packet that was buffered, then returns its buffers to the pool.
+    fn write_buffered_packet(&mut self, stream_index: usize, p: OwnedPacket, latency_90khz: u64) -> Result<(), EncodeError> {
+        let result = self.write_muxer_packet(
+            stream_index,
+            Packet {
+                data: Cow::Borrowed(&p.data),
+                random_access_indicator: p.random_access_indicator,
+                pts_90khz: p.pts_90khz,
+                dts_90khz: p.dts_90khz,
+                temi_timeline_descriptors: p.temi_timeline_descriptors,
+                private_data_bytes: Cow::Borrowed(&p.private_data_bytes),
+            },
+            latency_90khz,
+        );
+        for mut buf in [p.data, p.private_data_bytes] {
+            if buf.capacity() > 0 && self.buffer_pool.len() < self.max_buffered_packets {
+                buf.clear();
+                self.buffer_pool.push(buf);
+            }
+        }
+        result
+    }
+
+    /// Copies the packet into buffers from the pool, unless it already owns its data.
+    fn buffer_packet(&mut self, p: Packet) -> OwnedPacket {
+        self.buffered_packets += 1;
+        let mut to_vec = |data: Cow<[u8]>| match data {
+            Cow::Owned(data) => data,
+            Cow::Borrowed([]) => Vec::new(),
+            Cow::Borrowed(data) => {
+                let mut buf = self.buffer_pool.pop().unwrap_or_default();
+                buf.extend_from_slice(data);
+                buf
+            }
+        };
+        OwnedPacket {
+            data: to_vec(p.data),
+            random_access_indicator: p.random_access_indicator,
+            pts_90khz: p.pts_90khz,
+            dts_90khz: p.dts_90khz,
+            temi_timeline_descriptors: p.temi_timeline_descriptors,
+            private_data_bytes: to_vec(p.private_data_bytes),
+        }
+    }
+
+    /// Removes the packet at the front of the stream's buffer and adds it to the ready packets.
+    fn pop_ready_packet(&mut self, stream_index: usize) {
+        let stream = &mut self.streams[stream_index];
+        let p = stream.buffered_packets.pop_front().expect("there must be at least one packet to pop");
+        self.heads.update(stream_index, stream.buffered_packets.front().map(|p| p.ts));
+        if p.packet.is_some() {
+            self.buffered_packets -= 1;
+        }
+        self.ready_packets.push((stream_index, p));
+    }
+
+    /// Writes all of the ready packets in order. The placeholder for the packet currently being
+    /// written, if there is one, is skipped.
+    fn write_ready_packets(&mut self) -> Result<(), EncodeError> {
+        let mut ready_packets = mem::take(&mut self.ready_packets);
+        let mut result = Ok(());
+        for (stream_index, p) in ready_packets.drain(..) {
+            if result.is_ok() {
+                if let Some(packet) = p.packet {
+                    result = self.write_buffered_packet(stream_index, packet, self.largest_ts_in_buffer - p.largest_ts_when_buffered);
+                    self.streams[stream_index].last_written_ts = p.ts;
                 }
             }
         }
-        for (stream_index, ts, packet) in packets {
-            if let Some(p) = packet.2 {
-                self.write_muxer_packet(stream_index, p)?;
+        self.ready_packets = ready_packets;
+        result
+    }
+
+    fn emit_packets_outside_buffer_duration(&mut self) -> Result<(), EncodeError> {
+        // these are the packets for which largest_ts_in_buffer - ts > max_buffer_duration_90khz
+        let threshold = self.largest_ts_in_buffer.saturating_sub(self.max_buffer_duration_90khz);
+        let mut ready_streams = mem::take(&mut self.ready_streams);
+        self.heads.find_below(threshold, &mut ready_streams);
+        for &stream_index in &ready_streams {
+            while self.streams[stream_index].buffered_packets.front().map_or(false, |p| p.ts < threshold) {
+                self.pop_ready_packet(stream_index);
             }
-            self.streams[stream_index].last_written_ts = ts;
         }
-        Ok(())
+        ready_streams.clear();
+        self.ready_streams = ready_streams;
+        self.write_ready_packets()
     }
 
     fn emit_packets(&mut self, index: usize, p: Packet, ts: u64) -> Result<(), EncodeError> {
-        self.streams[index].buffered_packets.push_back((index, ts, None));
-        let mut enqueue_packet = true;
+        self.streams[index].buffered_packets.push_back(BufferedPacket {
+            ts,
+            largest_ts_when_buffered: self.largest_ts_in_buffer,
+            packet: None,
+        });
+        self.heads.update(index, self.streams[index].buffered_packets.front().map(|p| p.ts));
 
         // emit packets outsize max buffer duration
         self.emit_packets_outside_buffer_duration()?;
 
-        let mut packets = vec![];
+        // find the stream with the smallest packet timestamp (treating empty streams as having a
+        // timestamp of 0), and emit all of its packets that come before the other streams' packets
+        let mut enqueue_packet = true;
         loop {
-            let mut last_written_ts = 0;
-            let mut min_ts_stream_index = 0;
-            // find a stream with smallest packet timestamp and emit all packets in this stream if packets
-            // in all other streams with timestamps are larger
+            let i = self.heads.first_min();
+            let others_min_ts = self.heads.min_excluding(i);
             let mut emit_packets_found = false;
-            if let Some((i, _)) = self
-                .streams
-                .iter()
-                .enumerate()
-                .min_by_key(|(_, s)| if let Some(p) = s.buffered_packets.front() { p.1 } else { 0 })
-            {
-                if !self.streams[i].buffered_packets.is_empty() {
-                    let others_min_ts = self.min_ts_excluding(i);
-                    let stream = &mut self.streams[i];
-                    min_ts_stream_index = i;
-                    while let Some(first_packet) = stream.buffered_packets.front() {
-                        let first_packet_ts = first_packet.1;
-                        if first_packet_ts <= others_min_ts {
-                            let first_packet = stream.buffered_packets.pop_front().expect("there must be at least one packet to pop");
-                            if first_packet.2.is_none() {
-                                enqueue_packet = false;
-                            }
-                            packets.push(first_packet);
-                            last_written_ts = first_packet_ts;
-                            emit_packets_found = true;
-                        } else {
-                            break;
-                        }
+            while let Some(first_packet) = self.streams[i].buffered_packets.front() {
+                if first_packet.ts <= others_min_ts {
+                    if first_packet.packet.is_none() {
+                        enqueue_packet = false;
                     }
+                    self.streams[i].last_written_ts = first_packet.ts;
+                    self.pop_ready_packet(i);
+                    emit_packets_found = true;
+                } else {
+                    break;
                 }
             }
-            if emit_packets_found {
-                self.streams[min_ts_stream_index].last_written_ts = last_written_ts;
-            } else {
+            if !emit_packets_found {
                 break;
             }
         }
 
-        for (i, packet_ts, packet) in packets {
-            if let Some(p) = packet {
-                self.write_muxer_packet(i, p)?;
-                self.streams[i].last_written_ts = packet_ts;
-            }
-        }
+        self.write_ready_packets()?;
         if enqueue_packet {
-            self.streams[index].buffered_packets.pop_back();
-            self.streams[index].buffered_packets.push_back((index, ts, Some(p.into_owned())));
+            let p = self.buffer_packet(p);
+            let stream = &mut self.streams[index];
+            stream.buffered_packets.back_mut().expect("the placeholder must still be buffered").packet = Some(p);
+            stream.stats.max_buffered_packets = stream.stats.max_buffered_packets.max(stream.buffered_packets.len());
+            self.max_buffered_packets = self.max_buffered_packets.max(self.buffered_packets);
         } else {
-            self.write_muxer_packet(index, p)?;
+            self.write_muxer_packet(index, p, 0)?;
         }
 
         Ok(())
     }
 
-    fn min_ts_excluding(&self, stream_id: usize) -> u64 {
-        let mut min_ts = u64::MAX;
-        for (_, stream) in self.streams.iter().enumerate().filter(|&(index, _)| index != stream_id) {
-            if let Some(p) = stream.buffered_packets.front() {
-                min_ts = min_ts.min(p.1);
-            } else {
-                min_ts = 0;
-                break;
-            }
-        }
-        min_ts
-    }
-
     pub fn flush(&mut self) -> Result<(), EncodeError> {
+        let largest_ts_in_buffer = self.largest_ts_in_buffer;
         self.largest_ts_in_buffer = 0;
 
-        let mut packets = vec![];
-        self.streams.iter_mut().enumerate().for_each(|(stream_index, stream)| {
-            while let Some(p) = stream.buffered_packets.pop_front() {
-                packets.push((stream_index, p));
-            }
-            stream.last_written_ts = 0;
-        });
-
-        packets.sort_unstable_by_key(|(_, p)| p.0);
-        for (stream_index, packet) in packets {
-            // when emit_packets returns an error, it's possible that the None packets are still in the buffer,
-            if let Some(packet) = packet.2 {
-                self.write_muxer_packet(stream_index, packet)?;
+        // write the packets stream by stream
+        let mut result = Ok(());
+        for stream_index in 0..self.streams.len() {
+            while let Some(p) = self.streams[stream_index].buffered_packets.pop_front() {
+                // when emit_packets returns an error, it's possible that the None packets are still in the buffer,
+                if let Some(packet) = p.packet {
+                    self.buffered_packets -= 1;
+                    if result.is_ok() {
+                        result = self.write_buffered_packet(stream_index, packet, largest_ts_in_buffer - p.largest_ts_when_buffered);
+                    }
+                }
             }
+            self.streams[stream_index].last_written_ts = 0;
+            self.heads.update(stream_index, None);
         }
-        Ok(())
+        result?;
+        self.inner.flush()
     }
 }
 
@@ -217,6 +340,97 @@ impl<W: Write> Drop for InterleavingMuxer<W> {
     }
 }
 
+/// HeadTree is a tournament tree over the timestamps at the head of each stream's buffer. Each
+/// internal node holds the minimum of its children, so updating a stream or finding a minimum is
+/// O(log n) in the number of streams.
+struct HeadTree {
+    /// The number of leaves, which is a power of two. Leaves beyond the number of streams are
+    /// never the minimum.
+    leaves: usize,
+    /// Node 1 is the root, and the children of node i are 2i and 2i+1. Leaf i is node leaves + i.
+    nodes: Vec<HeadTreeNode>,
+}
+
+#[derive(Clone, Copy)]
+struct HeadTreeNode {
+    /// The minimum timestamp, with empty streams treated as 0, and the index of the first stream
+    /// with that timestamp.
+    min: (u64, usize),
+    /// The minimum timestamp of non-empty streams.
+    min_buffered: u64,
+}
+
+impl HeadTree {
+    const PADDING: HeadTreeNode = HeadTreeNode {
+        min: (u64::MAX, usize::MAX),
+        min_buffered: u64::MAX,
+    };
+
+    /// Creates a tree for the given number of streams, all of which are empty.
+    fn new(streams: usize) -> Self {
+        let leaves = streams.next_power_of_two();
+        let mut ret = Self {
+            leaves,
+            nodes: vec![Self::PADDING; 2 * leaves],
+        };
+        for i in 0..streams {
+            ret.update(i, None);
+        }
+        ret
+    }
+
+    fn update(&mut self, stream_index: usize, head_ts: Option<u64>) {
+        let mut node = self.leaves + stream_index;
+        self.nodes[node] = HeadTreeNode {
+            min: (head_ts.unwrap_or(0), stream_index),
+            min_buffered: head_ts.unwrap_or(u64::MAX),
+        };
+        while node > 1 {
+            node /= 2;
+            let (left, right) = (self.nodes[2 * node], self.nodes[2 * node + 1]);
+            self.nodes[node] = HeadTreeNode {
+                min: left.min.min(right.min),
+                min_buffered: left.min_buffered.min(right.min_buffered),
+            };
+        }
+    }
+
+    /// Returns the index of the first stream with the minimum timestamp.
+    fn first_min(&self) -> usize {
+        self.nodes[1].min.1
+    }
+
+    /// Returns the minimum timestamp of all streams except the given one, or u64::MAX if there are
+    /// no others.
+    fn min_excluding(&self, stream_index: usize) -> u64 {
+        let mut ret = u64::MAX;
+        let mut node = self.leaves + stream_index;
+        while node > 1 {
+            ret = ret.min(self.nodes[node ^ 1].min.0);
+            node /= 2;
+        }
+        ret
+    }
+
+    /// Appends the indices of all non-empty streams with timestamps less than threshold to dest,
+    /// in ascending order.
+    fn find_below(&self, threshold: u64, dest: &mut Vec<usize>) {
+        self.find_below_in(1, threshold, dest)
+    }
+
+    fn find_below_in(&self, node: usize, threshold: u64, dest: &mut Vec<usize>) {
+        if self.nodes[node].min_buffered >= threshold {
+            return;
+        }
+        if node >= self.leaves {
+            dest.push(node - self.leaves);
+        } else {
+            self.find_below_in(2 * node, threshold, dest);
+            self.find_below_in(2 * node + 1, threshold, dest);
+        }
+    }
+}
+
 #[cfg(test)]
 mod test {
     use super::*;
@@ -595,6 +809,83 @@ mod test {
         );
     }
 
+    #[test]
+    fn test_stream_stats() {
+        let w = TestWriter::default();
+
+        let mut muxer = InterleavingMuxer::new(&w, Duration::from_millis(500));
+        add_streams(&mut muxer, 2);
+
+        muxer.write(0, simple_packet(100)).unwrap();
+        muxer.write(1, simple_packet(50)).unwrap();
+        muxer.write(0, simple_packet(200)).unwrap();
+        assert_eq!(
+            muxer.stream_stats(0),
+            InterleavingStreamStats {
+                buffered_packets: 2,
+                max_buffered_packets: 2,
+                ..Default::default()
+            }
+        );
+
+        // The first packet was buffered while the largest timestamp advanced from 100 to 200.
+        muxer.write(1, simple_packet(150)).unwrap();
+        assert_eq!(
+            muxer.stream_stats(0),
+            InterleavingStreamStats {
+                buffered_packets: 1,
+                max_buffered_packets: 2,
+                written_packets: 1,
+                total_latency_90khz: 100,
+                max_latency_90khz: 100,
+            }
+        );
+        assert_eq!(
+            muxer.stream_stats(1),
+            InterleavingStreamStats {
+                written_packets: 2,
+                ..Default::default()
+            }
+        );
+
+        muxer.flush().unwrap();
+        assert_eq!(muxer.stream_stats(0).buffered_packets, 0);
+        assert_eq!(muxer.stream_stats(0).written_packets, 2);
+    }
+
+    /// With many streams, packets should be written in timestamp order regardless of the order
+    /// the streams provide them in.
+    #[test]
+    fn test_many_streams() {
+        const STREAMS: usize = 13;
+
+        let w = TestWriter::default();
+        let mut muxer = InterleavingMuxer::new(&w, Duration::from_millis(500));
+        add_streams(&mut muxer, STREAMS);
+
+        for frame in 0..20 {
+            // vary the order of the streams from frame to frame
+            for i in 0..STREAMS {
+                let stream_index = (i * 5 + frame) % STREAMS;
+                muxer
+                    .write(stream_index, simple_packet(1000 + frame as u64 * 100 + stream_index as u64))
+                    .unwrap();
+            }
+        }
+        muxer.flush().unwrap();
+
+        let packets = w.packets();
+        assert_eq!(packets.len(), STREAMS * 20);
+        for (a, b) in packets.iter().zip(packets.iter().skip(1)) {
+            assert!(a.pts_90khz < b.pts_90khz);
+        }
+        for i in 0..STREAMS {
+            let stats = muxer.stream_stats(i);
+            assert_eq!(stats.written_packets, 20);
+            assert!(stats.max_buffered_packets <= 2);
+        }
+    }
+
     #[test]
     fn test_oversized_presentation_times() {
         let w = TestWriter::default();
@@ -628,4 +919,176 @@ mod test {
             }
         }
     }
+
+    /// A model of the original interleaving algorithm, which scanned every stream on each write.
+    /// Written packets are recorded as (stream index, pts).
+    struct ReferenceInterleaver {
+        max_buffer_duration_90khz: u64,
+        largest_ts_in_buffer: u64,
+        /// Each stream's buffered packets as (ts, pts, is_packet). Packets that aren't packets are
+        /// placeholders for the packet being written.
+        streams: Vec<VecDeque<(u64, Option<u64>, bool)>>,
+        last_written_ts: Vec<u64>,
+        written: Vec<(usize, Option<u64>)>,
+    }
+
+    impl ReferenceInterleaver {
+        fn new(streams: usize, max_buffer_duration: Duration) -> Self {
+            Self {
+                max_buffer_duration_90khz: (max_buffer_duration.as_millis() * 90) as u64,
+                largest_ts_in_buffer: 0,
+                streams: vec![VecDeque::new(); streams],
+                last_written_ts: vec![0; streams],
+                written: vec![],
+            }
+        }
+
+        fn head_ts(&self, stream_index: usize) -> u64 {
+            self.streams[stream_index].front().map_or(0, |p| p.0)
+        }
+
+        fn min_ts_excluding(&self, stream_index: usize) -> u64 {
+            (0..self.streams.len())
+                .filter(|&i| i != stream_index)
+                .map(|i| self.head_ts(i))
+                .min()
+                .unwrap_or(u64::MAX)
+        }
+
+        fn write(&mut self, stream_index: usize, pts: Option<u64>) {
+            // packets without timestamps are considered to have the same timestamp as the last
+            // packet written from the stream
+            let ts = pts.unwrap_or(self.last_written_ts[stream_index]);
+            if ts < self.min_ts_excluding(stream_index) || ts < self.largest_ts_in_buffer.saturating_sub(self.max_buffer_duration_90khz) {
+                self.written.push((stream_index, pts));
+                self.last_written_ts[stream_index] = ts;
+                return;
+            }
+            self.largest_ts_in_buffer = self.largest_ts_in_buffer.max(ts);
+            self.streams[stream_index].push_back((ts, pts, false));
+
+            // packets outside the buffer duration are written first
+            for i in 0..self.streams.len() {
+                while let Some(&(front_ts, front_pts, is_packet)) = self.streams[i].front() {
+                    if self.largest_ts_in_buffer - front_ts <= self.max_buffer_duration_90khz {
+                        break;
+                    }
+                    self.streams[i].pop_front();
+                    if is_packet {
+                        self.written.push((i, front_pts));
+                    }
+                    self.last_written_ts[i] = front_ts;
+                }
+            }
+
+            let mut ready = vec![];
+            loop {
+                let i = (0..self.streams.len()).min_by_key(|&i| self.head_ts(i)).unwrap();
+                if self.streams[i].is_empty() {
+                    break;
+                }
+                let others_min_ts = self.min_ts_excluding(i);
+                while let Some(&(front_ts, front_pts, is_packet)) = self.streams[i].front() {
+                    if front_ts > others_min_ts {
+                        break;
+                    }
+                    self.streams[i].pop_front();
+                    ready.push((i, front_ts, front_pts, is_packet));
+                    self.last_written_ts[i] = front_ts;
+                }
+            }
+
+            let mut enqueue_packet = true;
+            for (i, ts, pts, is_packet) in ready {
+                if is_packet {
+                    self.written.push((i, pts));
+                    self.last_written_ts[i] = ts;
+                } else {
+                    enqueue_packet = false;
+                }
+            }
+            if enqueue_packet {
+                self.streams[stream_index].back_mut().unwrap().2 = true;
+            } else {
+                self.written.push((stream_index, pts));
+            }
+        }
+
+        /// The original flush sorted the buffered packets by stream index with an unstable sort.
+        /// This models the stream by stream order that it was meant to produce.
+        fn flush(&mut self) {
+            self.largest_ts_in_buffer = 0;
+            for (i, stream) in self.streams.iter_mut().enumerate() {
+                self.written.extend(stream.drain(..).map(|(_, pts, _)| (i, pts)));
+                self.last_written_ts[i] = 0;
+            }
+        }
+    }
+
+    /// Random streams, buffer durations, and writes should produce exactly the same output order
+    /// as the original algorithm. The writes include packets without timestamps, timestamps that
+    /// jump backwards, and flushes in the middle of the streams.
+    #[test]
+    fn test_output_order_matches_reference() {
+        // a fixed xorshift generator keeps failures reproducible
+        let mut state = 0x2545f4914f6cdd1du64;
+        let mut rand = move |n: u64| {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            state % n
+        };
+
+        for _ in 0..300 {
+            // up to 17 streams, so that some trees have more leaves than a power of two can hold
+            let stream_count = 1 + rand(17) as usize;
+            let max_buffer_duration = Duration::from_millis([0, 10, 30, 100, 500][rand(5) as usize]);
+            // some streams are written much more often than others, so they drift out of sync
+            let weights = (0..stream_count).map(|_| 1 + rand(4)).collect::<Vec<_>>();
+            let total_weight = weights.iter().sum::<u64>();
+
+            let w = TestWriter::default();
+            let mut muxer = InterleavingMuxer::new(&w, max_buffer_duration);
+            add_streams(&mut muxer, stream_count);
+            let mut reference = ReferenceInterleaver::new(stream_count, max_buffer_duration);
+            let written = || w.packets().iter().map(|p| (p.stream_index, p.pts_90khz)).collect::<Vec<_>>();
+
+            let mut clocks = vec![90_000u64; stream_count];
+            for _ in 0..300 {
+                if rand(100) == 0 {
+                    muxer.flush().unwrap();
+                    reference.flush();
+                    assert_eq!(muxer.buffered_packets, 0);
+                }
+
+                let mut pick = rand(total_weight);
+                let mut stream_index = 0;
+                while pick >= weights[stream_index] {
+                    pick -= weights[stream_index];
+                    stream_index += 1;
+                }
+                let pts = match rand(20) {
+                    0 => None,
+                    // a large jump backwards, like a discontinuity
+                    1 => Some(clocks[stream_index].saturating_sub(rand(50_000))),
+                    // timestamps mostly advance, but may jitter backwards like reordered frames
+                    _ => {
+                        clocks[stream_index] += rand(3000);
+                        Some(clocks[stream_index] + rand(2000))
+                    }
+                };
+
+                let mut p = simple_packet(0);
+                p.pts_90khz = pts;
+                muxer.write(stream_index, p).unwrap();
+                reference.write(stream_index, pts);
+                assert_eq!(written(), reference.written);
+            }
+
+            muxer.flush().unwrap();
+            reference.flush();
+            assert_eq!(written(), reference.written);
+            assert_eq!(muxer.buffered_packets, 0);
+        }
+    }
 }
@@ -10,7 +10,12 @@ struct StreamState {
     data: Vec<u8>,
 }
 
-pub struct Muxer<W> {
+/// Muxer packetizes each access unit directly into an internal buffer, then writes the buffer to
+/// the underlying writer once it reaches the batch size. By default, that's after every access
+/// unit. With larger batch sizes, the remainder is written by [`Muxer::flush`]. Like
+/// `std::io::BufWriter`, dropping the muxer also writes it, but errors are ignored, so call
+/// `flush` to find out about them.
+pub struct Muxer<W: Write> {
     w: W,
     next_packet_id: u16,
     pcr_pid: u16,
@@ -18,6 +23,14 @@ pub struct Muxer<W> {
     last_header_pcr: Option<u64>,
     header_continuity_counter: u8,
     streams: Vec<StreamState>,
+
+    /// Packets waiting to be written to w. This is always a multiple of the packet length.
+    buffer: Vec<u8>,
+    /// The buffer is written to w once it reaches this many bytes.
+    batch_size: usize,
+    /// The encoded PAT and PMT packets. These only change when streams are added, so they're only
+    /// re-encoded then. Only their continuity counters need to be updated.
+    encoded_headers: Vec<u8>,
 }
 
 #[derive(Clone, Debug)]
@@ -33,6 +46,13 @@ pub struct StreamConfig {
 
 impl<W: Write> Muxer<W> {
     pub fn new(w: W) -> Self {
+        Self::with_batch_size(w, 0)
+    }
+
+    /// Creates a muxer that buffers up to batch_size packets before writing them. Access units are
+    /// never split across writes, so batches may be larger than this. Buffered packets are written
+    /// when the muxer is flushed or dropped.
+    pub fn with_batch_size(w: W, batch_size: usize) -> Self {
         Self {
             w,
             next_packet_id: 0x100,
@@ -41,6 +61,9 @@ impl<W: Write> Muxer<W> {
             did_write_headers: false,
             header_continuity_counter: 0,
             streams: vec![],
+            buffer: Vec::with_capacity((batch_size + 1) * ts::PACKET_LENGTH),
+            batch_size: batch_size * ts::PACKET_LENGTH,
+            encoded_headers: vec![],
         }
     }
 
@@ -53,6 +76,7 @@ impl<W: Write> Muxer<W> {
             data: config.data,
         });
         self.pcr_pid = packet_id;
+        self.encoded_headers.clear();
         Stream {
             packet_id,
             continuity_counter: 0,
@@ -66,26 +90,52 @@ impl<W: Write> Muxer<W> {
             header: pes::PacketHeader::new(stream, &p),
             data: p.data,
         };
-        for ts_packet in pes_packet.packetize(pes::PacketizationConfig {
+
+        // Only the first packet of each access unit has a PCR, so this is the only one that can
+        // trigger the headers.
+        let pcr = pes_packet.header.optional_header.as_ref().and_then(|h| h.dts.or(h.pts)).map(|dts| dts * 300);
+        self.write_headers_if_needed(stream.packet_id, pcr)?;
+
+        let mut packetize = pes_packet.packetize(pes::PacketizationConfig {
             packet_id: stream.packet_id,
             continuity_counter: stream.continuity_counter,
             random_access_indicator: p.random_access_indicator,
             temi_timeline_descriptors: p.temi_timeline_descriptors,
             private_data_bytes: &p.private_data_bytes,
-        }) {
-            if ts_packet.payload.is_some() {
-                stream.continuity_counter = (stream.continuity_counter + 1) % 16;
-            }
-            self.write_ts_packet(ts_packet)?;
+        });
+        let len = self.buffer.len();
+        if let Err(e) = packetize.encode_remaining(&mut self.buffer) {
+            // drop the partially encoded access unit
+            self.buffer.truncate(len);
+            return Err(e);
+        }
+        stream.continuity_counter = packetize.continuity_counter();
+
+        if self.buffer.len() >= self.batch_size {
+            self.write_buffer()?;
         }
         Ok(())
     }
 
-    fn write_ts_packet(&mut self, p: ts::Packet) -> Result<(), EncodeError> {
-        let pcr = p.adaptation_field.as_ref().and_then(|af| af.program_clock_reference_27mhz);
+    /// Writes any buffered packets, then flushes the underlying writer.
+    pub fn flush(&mut self) -> Result<(), EncodeError> {
+        self.write_buffer()?;
+        self.w.flush()?;
+        Ok(())
+    }
 
+    fn write_buffer(&mut self) -> Result<(), EncodeError> {
+        if !self.buffer.is_empty() {
+            let result = self.w.write_all(&self.buffer);
+            self.buffer.clear();
+            result?;
+        }
+        Ok(())
+    }
+
+    fn write_headers_if_needed(&mut self, packet_id: u16, pcr: Option<u64>) -> Result<(), EncodeError> {
         let mut should_write_headers = !self.did_write_headers;
-        if p.packet_id == self.pcr_pid && self.did_write_headers {
+        if packet_id == self.pcr_pid && self.did_write_headers {
             // figure out if we need to repeat the headers
             if let Some(pcr) = pcr {
                 if self.last_header_pcr.is_none() {
@@ -101,78 +151,14 @@ impl<W: Write> Muxer<W> {
         }
 
         if should_write_headers {
-            const PMT_PID: u16 = 0x1000;
-
-            // write the PAT
-            {
-                let pat = ts::PATData {
-                    entries: vec![ts::PATEntry {
-                        program_number: 1,
-                        program_map_pid: PMT_PID,
-                    }],
-                };
-                let mut encoded = vec![];
-                pat.encode(&mut encoded)?;
-                let section = ts::TableSyntaxSection {
-                    table_id_extension: 1,
-                    data: &encoded,
-                };
-                let mut encoded = vec![];
-                section.encode_without_crc(&mut encoded)?;
-                let section = ts::TableSection {
-                    table_id: ts::TABLE_ID_PAT,
-                    section_syntax_indicator: true,
-                    data_without_crc: &encoded,
-                };
-                let mut encoded = vec![];
-                ts::encode_table_sections([section], &mut encoded, ts::Packet::max_payload_len(None))?;
-                let p = ts::Packet {
-                    packet_id: ts::PID_PAT,
-                    payload_unit_start_indicator: true,
-                    continuity_counter: self.header_continuity_counter,
-                    adaptation_field: None,
-                    payload: Some(encoded.into()),
-                };
-                p.encode(&mut self.w)?;
+            if self.encoded_headers.is_empty() {
+                self.encoded_headers = self.encode_headers()?;
             }
 
-            // write the PMT
-            {
-                let pmt = ts::PMTData {
-                    pcr_pid: self.pcr_pid,
-                    elementary_stream_info: self
-                        .streams
-                        .iter()
-                        .map(|s| ts::PMTElementaryStreamInfo {
-                            elementary_pid: s.pid,
-                            stream_type: s.stream_type,
-                            data: &s.data,
-                        })
-                        .collect(),
-                };
-                let mut encoded = vec![];
-                pmt.encode(&mut encoded)?;
-                let section = ts::TableSyntaxSection {
-                    table_id_extension: 1,
-                    data: &encoded,
-                };
-                let mut encoded = vec![];
-                section.encode_without_crc(&mut encoded)?;
-                let section = ts::TableSection {
-                    table_id: ts::TABLE_ID_PMT,
-                    section_syntax_indicator: true,
-                    data_without_crc: &encoded,
-                };
-                let mut encoded = vec![];
-                ts::encode_table_sections([section], &mut encoded, ts::Packet::max_payload_len(None))?;
-                let p = ts::Packet {
-                    packet_id: PMT_PID,
-                    payload_unit_start_indicator: true,
-                    continuity_counter: self.header_continuity_counter,
-                    adaptation_field: None,
-                    payload: Some(encoded.into()),
-                };
-                p.encode(&mut self.w)?;
+            self.buffer.extend_from_slice(&self.encoded_headers);
+            let len = self.buffer.len();
+            for packet in self.buffer[len - self.encoded_headers.len()..].chunks_exact_mut(ts::PACKET_LENGTH) {
+                packet[3] = (packet[3] & 0xf0) | self.header_continuity_counter;
             }
 
             self.did_write_headers = true;
@@ -180,9 +166,88 @@ impl<W: Write> Muxer<W> {
             self.header_continuity_counter = (self.header_continuity_counter + 1) % 16;
         }
 
-        p.encode(&mut self.w)?;
         Ok(())
     }
+
+    /// Encodes the PAT and PMT packets with continuity counters of 0.
+    fn encode_headers(&self) -> Result<Vec<u8>, EncodeError> {
+        const PMT_PID: u16 = 0x1000;
+        let mut ret = Vec::with_capacity(ts::PACKET_LENGTH * 2);
+
+        // encode the PAT
+        {
+            let pat = ts::PATData {
+                entries: vec![ts::PATEntry {
+                    program_number: 1,
+                    program_map_pid: PMT_PID,
+                }],
+            };
+            let mut encoded = vec![];
+            pat.encode(&mut encoded)?;
+            let section = ts::TableSyntaxSection {
+                table_id_extension: 1,
+                data: &encoded,
+            };
+            let mut encoded = vec![];
+            section.encode_without_crc(&mut encoded)?;
+            let section = ts::TableSection {
+                table_id: ts::TABLE_ID_PAT,
+                section_syntax_indicator: true,
+                data_without_crc: &encoded,
+            };
+            let mut encoded = vec![];
+            ts::encode_table_sections([section], &mut encoded, ts::Packet::max_payload_len(None))?;
+            let p = ts::Packet {
+                packet_id: ts::PID_PAT,
+                payload_unit_start_indicator: true,
+                continuity_counter: 0,
+                adaptation_field: None,
+                payload: Some(encoded.into()),
+            };
+            p.encode(&mut ret)?;
+        }
+
+        // encode the PMT
+        {
+            let pmt = ts::PMTData {
+                pcr_pid: self.pcr_pid,
+                elementary_stream_info: self
+                    .streams
+                    .iter()
+                    .map(|s| ts::PMTElementaryStreamInfo {
+                        elementary_pid: s.pid,
+                        stream_type: s.stream_type,
+                        data: &s.data,
+                    })
+                    .collect(),
+            };
+            let mut encoded = vec![];
+            pmt.encode(&mut encoded)?;
+            let section = ts::TableSyntaxSection {
+                table_id_extension: 1,
+                data: &encoded,
+            };
+            let mut encoded = vec![];
+            section.encode_without_crc(&mut encoded)?;
+            let section = ts::TableSection {
+                table_id: ts::TABLE_ID_PMT,
+                section_syntax_indicator: true,
+                data_without_crc: &encoded,
+            };
+            let mut encoded = vec![];
+            ts::encode_table_sections([section], &mut encoded, ts::Packet::max_payload_len(None))?;
+            let p = ts::Packet {
+                packet_id: PMT_PID,
+                payload_unit_start_indicator: true,
+                continuity_counter: 0,
+                adaptation_field: None,
+                payload: Some(encoded.into()),
+            };
+            p.encode(&mut ret)?;
+        }
+
+        Ok(ret)
+    }
 }
 
 #[derive(Default)]
@@ -229,6 +294,13 @@ impl Stream {
     }
 }
 
+impl<W: Write> Drop for Muxer<W> {
+    fn drop(&mut self) {
+        // Errors are ignored when writing the buffered packets.
+        let _ = self.write_buffer();
+    }
+}
+
 #[cfg(test)]
 mod test {
     use super::*;
@@ -285,4 +357,72 @@ mod test {
         // uncomment this to write to a file for testing with other programs
         //File::create("tmp.ts").unwrap().write_all(&data_out).unwrap();
     }
+
+    #[test]
+    fn test_muxer_batch_size() {
+        let data = (0..5000).map(|i| i as u8).collect::<Vec<_>>();
+        let mux = |batch_size: usize, flush: bool| {
+            let mut data_out = Vec::new();
+            let written_before_flush;
+            {
+                let mut muxer = Muxer::with_batch_size(&mut data_out, batch_size);
+                let mut video = muxer.new_stream(StreamConfig {
+                    stream_id: 0xe0,
+                    stream_type: 0x1b,
+                    data: vec![],
+                    unbounded_data_length: true,
+                });
+                let mut audio = muxer.new_stream(StreamConfig {
+                    stream_id: 0xc0,
+                    stream_type: 0x0f,
+                    data: vec![],
+                    unbounded_data_length: false,
+                });
+                for i in 0..100 {
+                    let (stream, len) = if i % 3 == 0 { (&mut audio, 300) } else { (&mut video, 1000 + i * 37) };
+                    muxer
+                        .write(
+                            stream,
+                            Packet {
+                                data: Cow::Borrowed(&data[..len]),
+                                random_access_indicator: i % 30 == 0,
+                                // advance by 50ms so that the headers are repeated every other access unit
+                                pts_90khz: Some(i as u64 * 4500),
+                                ..Default::default()
+                            },
+                        )
+                        .unwrap();
+                }
+                written_before_flush = muxer.w.len();
+                if flush {
+                    muxer.flush().unwrap();
+                }
+            }
+            (data_out, written_before_flush)
+        };
+
+        let (expected, written) = mux(0, true);
+        assert_eq!(written, expected.len());
+        for &batch_size in &[1, 10, 1000] {
+            let (data_out, written) = mux(batch_size, true);
+            assert_eq!(data_out, expected);
+            assert_eq!(written % ts::PACKET_LENGTH, 0);
+            assert!(written < expected.len() || batch_size == 1);
+
+            // dropping the muxer without flushing it still writes the remainder
+            let (data_out, _) = mux(batch_size, false);
+            assert_eq!(data_out, expected);
+        }
+
+        let packets = ts::decode_packets(&expected).unwrap();
+        let pat_continuity_counters = packets
+            .iter()
+            .filter(|p| p.packet_id == ts::PID_PAT)
+            .map(|p| p.continuity_counter)
+            .collect::<Vec<_>>();
+        assert!(pat_continuity_counters.len() > 16);
+        for (i, cc) in pat_continuity_counters.into_iter().enumerate() {
+            assert_eq!(cc as usize, i % 16);
+        }
+    }
 }
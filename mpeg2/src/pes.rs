@@ -36,22 +36,91 @@ pub struct Packetize<'a> {
     config: PacketizationConfig<'a>,
 }
 
+impl<'a> Packetize<'a> {
+    /// Returns the continuity counter that will be used for the next packet.
+    pub fn continuity_counter(&self) -> u8 {
+        self.config.continuity_counter
+    }
+
+    fn first_adaptation_field(&mut self, header: &PacketHeader) -> ts::AdaptationField<'a> {
+        let mut af = ts::AdaptationField {
+            random_access_indicator: if self.config.random_access_indicator { Some(true) } else { None },
+            temi_timeline_descriptors: mem::take(&mut self.config.temi_timeline_descriptors),
+            private_data_bytes: Cow::Borrowed(self.config.private_data_bytes),
+            ..Default::default()
+        };
+        if let Some(dts) = header.optional_header.as_ref().and_then(|h| h.dts.or(h.pts)) {
+            af.program_clock_reference_27mhz = Some(dts * 300);
+        }
+        af
+    }
+
+    /// Encodes all of the remaining packets to w. The output is identical to encoding each of the
+    /// packets produced by the iterator, but no intermediate packets are constructed, so nothing is
+    /// allocated. This is most efficient if w is a buffer that's flushed elsewhere. Returns the
+    /// number of bytes written.
+    pub fn encode_remaining<W: Write>(&mut self, mut w: W) -> Result<usize, EncodeError> {
+        let mut ret = 0;
+
+        if let Some(header) = self.header.take() {
+            let af = self.first_adaptation_field(header);
+            let max_payload_len = ts::Packet::max_payload_len(Some(&af));
+
+            let mut header_buf = [0u8; MAX_ENCODED_HEADER_LENGTH];
+            let header_len = header.encode(&mut header_buf[..])?;
+            let mut data_consumed = max_payload_len.min(self.data.len());
+            data_consumed -= header_len.min(data_consumed);
+            let payload_len = header_len + data_consumed;
+
+            w.write_all(&ts::Packet::encode_header(
+                self.config.packet_id,
+                true,
+                self.config.continuity_counter,
+                true,
+                true,
+            ))?;
+            let af_len = af.encode(&mut w, ts::PACKET_LENGTH - ts::PACKET_HEADER_LENGTH - payload_len)?;
+            if ts::PACKET_HEADER_LENGTH + af_len + payload_len != ts::PACKET_LENGTH {
+                return Err(EncodeError::other("invalid data length"));
+            }
+            w.write_all(&header_buf[..header_len])?;
+            w.write_all(&self.data[..data_consumed])?;
+
+            self.config.continuity_counter = (self.config.continuity_counter + 1) % 16;
+            self.data = &self.data[data_consumed..];
+            ret += ts::PACKET_LENGTH;
+        }
+
+        const MAX_PAYLOAD_LEN: usize = ts::PACKET_LENGTH - ts::PACKET_HEADER_LENGTH;
+        while !self.data.is_empty() {
+            let payload_len = MAX_PAYLOAD_LEN.min(self.data.len());
+            let has_adaptation_field = payload_len < MAX_PAYLOAD_LEN;
+            w.write_all(&ts::Packet::encode_header(
+                self.config.packet_id,
+                false,
+                self.config.continuity_counter,
+                has_adaptation_field,
+                true,
+            ))?;
+            if has_adaptation_field {
+                ts::AdaptationField::default().encode(&mut w, MAX_PAYLOAD_LEN - payload_len)?;
+            }
+            w.write_all(&self.data[..payload_len])?;
+
+            self.config.continuity_counter = (self.config.continuity_counter + 1) % 16;
+            self.data = &self.data[payload_len..];
+            ret += ts::PACKET_LENGTH;
+        }
+
+        Ok(ret)
+    }
+}
+
 impl<'a> Iterator for Packetize<'a> {
     type Item = ts::Packet<'a>;
 
     fn next(&mut self) -> Option<Self::Item> {
-        let adaptation_field = self.header.map(|header| {
-            let mut af = ts::AdaptationField {
-                random_access_indicator: if self.config.random_access_indicator { Some(true) } else { None },
-                temi_timeline_descriptors: mem::take(&mut self.config.temi_timeline_descriptors),
-                private_data_bytes: Cow::Borrowed(self.config.private_data_bytes),
-                ..Default::default()
-            };
-            if let Some(dts) = header.optional_header.as_ref().and_then(|h| h.dts.or(h.pts)) {
-                af.program_clock_reference_27mhz = Some(dts * 300);
-            }
-            af
-        });
+        let adaptation_field = self.header.map(|header| self.first_adaptation_field(header));
 
         if adaptation_field.is_none() && self.data.is_empty() {
             None
@@ -138,7 +207,7 @@ impl PacketHeader {
     }
 
     pub fn encode<W: Write>(&self, mut w: W) -> Result<usize, EncodeError> {
-        let mut buf = [0u8; 6 + MAX_ENCODED_OPTIONAL_HEADER_LENGTH];
+        let mut buf = [0u8; MAX_ENCODED_HEADER_LENGTH];
         buf[2] = 1; // start code prefix
         buf[3] = self.stream_id;
         let optional_header_length = match &self.optional_header {
@@ -164,6 +233,7 @@ pub struct OptionalHeader {
 }
 
 const MAX_ENCODED_OPTIONAL_HEADER_LENGTH: usize = 13;
+const MAX_ENCODED_HEADER_LENGTH: usize = 6 + MAX_ENCODED_OPTIONAL_HEADER_LENGTH;
 
 impl OptionalHeader {
     pub fn decode(buf: &[u8]) -> Result<(Self, usize), DecodeError> {
@@ -311,6 +381,116 @@ impl Stream {
     }
 }
 
+/// A piece of a PES packet as returned by [`ChunkedStream`].
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub enum Chunk<'a> {
+    /// The start of a new packet.
+    Start(PacketHeader),
+    /// More of the current packet's data.
+    Data(&'a [u8]),
+    /// The current packet is complete. Its data is the concatenation of all of its `Data` chunks.
+    End,
+    /// The current packet was abandoned before it was completed, so its `Data` chunks should be
+    /// disregarded.
+    Discard,
+}
+
+/// Iterator over the chunks returned by [`ChunkedStream::write`].
+pub struct Chunks<'a> {
+    // a transport packet can end one pes packet, then start, provide data for, and end another. these
+    // are returned in that order
+    previous: Option<Chunk<'static>>,
+    start: Option<PacketHeader>,
+    data: &'a [u8],
+    end: bool,
+}
+
+impl<'a> Iterator for Chunks<'a> {
+    type Item = Chunk<'a>;
+
+    #[inline]
+    fn next(&mut self) -> Option<Self::Item> {
+        if let Some(chunk) = self.previous.take() {
+            Some(chunk)
+        } else if let Some(header) = self.start.take() {
+            Some(Chunk::Start(header))
+        } else if !self.data.is_empty() {
+            Some(Chunk::Data(mem::take(&mut self.data)))
+        } else if self.end {
+            self.end = false;
+            Some(Chunk::End)
+        } else {
+            None
+        }
+    }
+}
+
+/// ChunkedStream delimits PES packets like [`Stream`], but never copies their data. Instead, the
+/// payload of each transport packet is returned as a chunk that borrows from it, and it's up to the
+/// caller to process or retain the chunks as needed.
+#[derive(Clone, Default)]
+pub struct ChunkedStream {
+    // the length of the current packet's data, if there is a current packet
+    data_length: Option<usize>,
+    // how much of the current packet's data has been returned
+    data_written: usize,
+}
+
+impl ChunkedStream {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Writes a transport packet to the stream, returning the resulting PES packet chunks.
+    #[inline]
+    pub fn write<'a>(&mut self, packet: &'a ts::Packet) -> Result<Chunks<'a>, DecodeError> {
+        let mut chunks = Chunks {
+            previous: None,
+            start: None,
+            data: &[],
+            end: false,
+        };
+
+        if let Some(payload) = &packet.payload {
+            let mut data: &[u8] = payload;
+
+            if packet.payload_unit_start_indicator {
+                chunks.previous = self.flush();
+
+                let (header, header_size) = PacketHeader::decode(payload)?;
+                self.data_length = Some(header.data_length);
+                self.data_written = 0;
+                chunks.start = Some(header);
+                data = &payload[header_size..];
+            }
+
+            let data_length = match self.data_length {
+                Some(data_length) => data_length,
+                None => return Ok(chunks),
+            };
+            if data_length > 0 {
+                data = &data[..data.len().min(data_length - self.data_written)];
+            }
+            self.data_written += data.len();
+            chunks.data = data;
+            if data_length > 0 && self.data_written >= data_length {
+                self.data_length = None;
+                chunks.end = true;
+            }
+        }
+
+        Ok(chunks)
+    }
+
+    /// Ends the current packet. Like [`Stream::flush`], only packets with unbounded lengths can be
+    /// completed this way. Others are discarded.
+    pub fn flush(&mut self) -> Option<Chunk<'static>> {
+        self.data_length
+            .take()
+            .map(|data_length| if data_length == 0 { Chunk::End } else { Chunk::Discard })
+    }
+}
+
 #[cfg(test)]
 mod test {
     use super::*;
@@ -354,6 +534,131 @@ mod test {
         assert_eq!(decoded_oh.dts.unwrap(), ts);
     }
 
+    #[test]
+    fn test_chunked_stream() {
+        let packet = |data_length: usize, data: &[u8]| {
+            let header = PacketHeader {
+                stream_id: 0xe0,
+                optional_header: Some(OptionalHeader {
+                    data_alignment_indicator: true,
+                    pts: Some(data.len() as _),
+                    dts: None,
+                }),
+                data_length,
+            };
+            let mut buf = vec![];
+            header.encode(&mut buf).unwrap();
+            buf.extend_from_slice(data);
+            buf
+        };
+
+        let data = (0..200u8).collect::<Vec<_>>();
+        let mut payloads = vec![];
+        // an unbounded packet
+        let first = packet(0, &data[..150]);
+        payloads.push((true, first[..100].to_vec()));
+        payloads.push((false, first[100..].to_vec()));
+        // a bounded packet with padding after its data
+        let mut second = packet(120, &data[..120]);
+        second.extend_from_slice(&[0xff; 30]);
+        payloads.push((true, second[..60].to_vec()));
+        payloads.push((false, second[60..].to_vec()));
+        // a bounded packet that is cut off
+        payloads.push((true, packet(120, &data[..50])));
+        // an unbounded packet that is only completed by a flush
+        payloads.push((true, packet(0, &data[..10])));
+
+        let packets = payloads
+            .into_iter()
+            .map(|(payload_unit_start_indicator, payload)| ts::Packet {
+                packet_id: 0x100,
+                payload_unit_start_indicator,
+                continuity_counter: 0,
+                adaptation_field: None,
+                payload: Some(payload.into()),
+            })
+            .collect::<Vec<_>>();
+
+        let mut stream = Stream::new();
+        let mut expected = vec![];
+        for packet in &packets {
+            expected.extend(stream.write(packet).unwrap());
+        }
+        expected.extend(stream.flush());
+        assert_eq!(expected.len(), 3);
+
+        let mut stream = ChunkedStream::new();
+        let mut chunks = vec![];
+        for packet in &packets {
+            chunks.extend(stream.write(packet).unwrap());
+        }
+        chunks.extend(stream.flush());
+
+        let mut reassembled = vec![];
+        let mut pending = None;
+        for chunk in chunks {
+            match chunk {
+                Chunk::Start(header) => pending = Some((header, vec![])),
+                Chunk::Data(chunk) => pending.as_mut().unwrap().1.extend_from_slice(chunk),
+                Chunk::End => {
+                    let (header, data) = pending.take().unwrap();
+                    reassembled.push(Packet { header, data: data.into() });
+                }
+                Chunk::Discard => pending = None,
+            }
+        }
+        assert_eq!(reassembled, expected);
+    }
+
+    #[test]
+    fn test_packetize_encode_remaining() {
+        let data = (0..1000).map(|i| i as u8).collect::<Vec<_>>();
+        for &len in &[0, 1, 14, 150, 169, 170, 171, 183, 184, 185, 367, 368, 1000] {
+            for &(random_access_indicator, private_data_bytes, temi) in &[(false, &[][..], false), (true, &b"txm0"[..], true)] {
+                let packet = Packet {
+                    header: PacketHeader {
+                        stream_id: 0xe0,
+                        optional_header: Some(OptionalHeader {
+                            data_alignment_indicator: true,
+                            pts: Some(len as _),
+                            dts: if temi { Some(len as u64 / 2) } else { None },
+                        }),
+                        data_length: len,
+                    },
+                    data: Cow::Borrowed(&data[..len]),
+                };
+                let config = PacketizationConfig {
+                    packet_id: 0x100,
+                    random_access_indicator,
+                    continuity_counter: 14,
+                    temi_timeline_descriptors: if temi {
+                        vec![TEMITimelineDescriptor {
+                            timescale: 1000,
+                            timeline_id: 1,
+                            ..Default::default()
+                        }]
+                    } else {
+                        vec![]
+                    },
+                    private_data_bytes,
+                };
+
+                let mut expected = vec![];
+                let mut packets = packet.packetize(config.clone());
+                for p in &mut packets {
+                    p.encode(&mut expected).unwrap();
+                }
+
+                let mut encoded = vec![];
+                let mut packetize = packet.packetize(config);
+                assert_eq!(packetize.encode_remaining(&mut encoded).unwrap(), encoded.len());
+                assert_eq!(encoded, expected);
+                assert_eq!(packetize.continuity_counter(), packets.continuity_counter());
+                assert!(packetize.next().is_none());
+            }
+        }
+    }
+
     /// Tests that if timestamps using more than 33 bits are given, the high bits are dropped and
     /// don't corrupt the header.
     #[test]
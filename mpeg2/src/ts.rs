@@ -154,8 +154,12 @@ impl AdaptationField<'_> {
                 0
             };
 
-        let mut buf = vec![0u8; af_length_no_padding + 1];
-        let mut bs = BitstreamWriter::new(&mut buf[1..]);
+        if af_length_no_padding + 1 > PACKET_LENGTH - PACKET_HEADER_LENGTH {
+            return Err(EncodeError::other("adaptation field too long"));
+        }
+
+        let mut buf = [0u8; PACKET_LENGTH - PACKET_HEADER_LENGTH];
+        let mut bs = BitstreamWriter::new(&mut buf[1..af_length_no_padding + 1]);
 
         if has_af_flags {
             bs.write_boolean(self.discontinuity_indicator.unwrap_or(false));
@@ -195,18 +199,29 @@ impl AdaptationField<'_> {
 
         if af_length_no_padding + 1 < pad_to_length {
             buf[0] = (pad_to_length - 1) as _;
-            w.write_all(&buf)?;
-            let padding = vec![0xff; pad_to_length - af_length_no_padding - 1];
-            w.write_all(&padding)?;
+            w.write_all(&buf[..af_length_no_padding + 1])?;
+            write_padding(&mut w, pad_to_length - af_length_no_padding - 1)?;
             Ok(pad_to_length)
         } else {
             buf[0] = af_length_no_padding as _;
-            w.write_all(&buf)?;
+            w.write_all(&buf[..af_length_no_padding + 1])?;
             Ok(af_length_no_padding + 1)
         }
     }
 }
 
+/// Writes n stuffing bytes (0xff) without allocating. n may be any length, but is typically less
+/// than a packet.
+fn write_padding<W: Write>(mut w: W, mut n: usize) -> Result<(), EncodeError> {
+    const PADDING: [u8; PACKET_LENGTH] = [0xff; PACKET_LENGTH];
+    while n > 0 {
+        let len = n.min(PADDING.len());
+        w.write_all(&PADDING[..len])?;
+        n -= len;
+    }
+    Ok(())
+}
+
 pub const TABLE_ID_PAT: u8 = 0;
 pub const TABLE_ID_PMT: u8 = 2;
 
@@ -230,8 +245,7 @@ pub fn encode_table_sections<'a, I: IntoIterator<Item = TableSection<'a>>, W: Wr
         len += section.encode(&mut w)?;
     }
     if len < pad_to_length {
-        let padding = vec![0xff; pad_to_length - len];
-        w.write_all(&padding)?;
+        write_padding(&mut w, pad_to_length - len)?;
         len = pad_to_length;
     }
     Ok(len)
@@ -467,7 +481,7 @@ impl<'a> PMTData<'a> {
     }
 }
 
-const PACKET_HEADER_LENGTH: usize = 4;
+pub(crate) const PACKET_HEADER_LENGTH: usize = 4;
 pub const PACKET_LENGTH: usize = 188;
 
 impl<'a> Packet<'a> {
@@ -536,24 +550,13 @@ impl<'a> Packet<'a> {
     }
 
     pub fn encode<W: Write>(&self, mut w: W) -> Result<usize, EncodeError> {
-        let mut buf = [0u8; PACKET_HEADER_LENGTH];
-        buf[0] = 0x47;
-
-        if self.payload_unit_start_indicator {
-            buf[1] |= 0x40;
-        }
-
-        buf[1] |= (self.packet_id >> 8) as u8;
-        buf[2] = self.packet_id as _;
-        buf[3] = self.continuity_counter as _;
-
-        if self.adaptation_field.is_some() {
-            buf[3] |= 0b00100000;
-        }
-
-        if self.payload.is_some() {
-            buf[3] |= 0b00010000;
-        }
+        let buf = Self::encode_header(
+            self.packet_id,
+            self.payload_unit_start_indicator,
+            self.continuity_counter,
+            self.adaptation_field.is_some(),
+            self.payload.is_some(),
+        );
 
         let mut ret = PACKET_HEADER_LENGTH;
         w.write_all(&buf)?;
@@ -574,12 +577,89 @@ impl<'a> Packet<'a> {
         }
     }
 
+    /// Encodes the fixed 4 byte header that begins every packet.
+    pub(crate) fn encode_header(
+        packet_id: u16,
+        payload_unit_start_indicator: bool,
+        continuity_counter: u8,
+        has_adaptation_field: bool,
+        has_payload: bool,
+    ) -> [u8; PACKET_HEADER_LENGTH] {
+        let mut buf = [0u8; PACKET_HEADER_LENGTH];
+        buf[0] = 0x47;
+
+        if payload_unit_start_indicator {
+            buf[1] |= 0x40;
+        }
+
+        buf[1] |= (packet_id >> 8) as u8;
+        buf[2] = packet_id as _;
+        buf[3] = continuity_counter as _;
+
+        if has_adaptation_field {
+            buf[3] |= 0b00100000;
+        }
+
+        if has_payload {
+            buf[3] |= 0b00010000;
+        }
+
+        buf
+    }
+
     /// Returns the maximum possible data length for a packet with the given adaptation field.
     pub fn max_payload_len(af: Option<&AdaptationField>) -> usize {
         PACKET_LENGTH - PACKET_HEADER_LENGTH - af.map(|af| af.encoded_len()).unwrap_or(0)
     }
 }
 
+/// PacketSummary holds the fields of a packet that can be read directly from fixed offsets, without
+/// decoding the adaptation field's optional sections or allocating. It's meant for building an index
+/// over many packets cheaply, so that only the ones that matter need a full [`Packet::decode`].
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct PacketSummary {
+    pub packet_id: u16,
+    pub payload_unit_start_indicator: bool,
+    pub random_access_indicator: bool,
+    pub program_clock_reference_27mhz: Option<u64>,
+    /// True if the adaptation field has transport private data or an extension (which is where
+    /// TEMI descriptors live). These can only be read with a full decode.
+    pub has_adaptation_field_data: bool,
+}
+
+impl PacketSummary {
+    pub fn decode(buf: &[u8]) -> Result<Self, DecodeError> {
+        if buf.len() != PACKET_LENGTH {
+            return Err(DecodeError::new("incorrect packet length"));
+        }
+
+        if buf[0] != 0x47 {
+            return Err(DecodeError::new("incorrect sync byte"));
+        }
+
+        let mut ret = Self {
+            packet_id: ((buf[1] & 0x1f) as u16) << 8 | buf[2] as u16,
+            payload_unit_start_indicator: buf[1] & 0x40 != 0,
+            ..Default::default()
+        };
+
+        let af_length = buf[PACKET_HEADER_LENGTH];
+        if buf[3] & 0x20 != 0 && af_length > 0 {
+            let flags = buf[PACKET_HEADER_LENGTH + 1];
+            ret.random_access_indicator = flags & 0x40 != 0;
+            if af_length >= 7 && flags & 0x10 != 0 {
+                let pcr = &buf[PACKET_HEADER_LENGTH + 2..PACKET_HEADER_LENGTH + 8];
+                let base = (u32::from_be_bytes([pcr[0], pcr[1], pcr[2], pcr[3]]) as u64) << 1 | (pcr[4] >> 7) as u64;
+                let ext = ((pcr[4] & 1) as u64) << 8 | pcr[5] as u64;
+                ret.program_clock_reference_27mhz = Some(base * 300 + ext);
+            }
+            ret.has_adaptation_field_data = flags & 0x03 != 0;
+        }
+
+        Ok(ret)
+    }
+}
+
 pub fn decode_packets(buf: &[u8]) -> Result<Vec<Packet>, DecodeError> {
     buf.chunks(PACKET_LENGTH).map(Packet::decode).collect()
 }
@@ -590,6 +670,37 @@ mod test {
     use crate::temi::TimeFieldLength;
     use std::{fs::File, io::Read};
 
+    #[test]
+    fn test_packet_summary() {
+        let mut f = File::open("src/testdata/uk_psb1_temi.ts").unwrap();
+        let mut buf = Vec::new();
+        f.read_to_end(&mut buf).unwrap();
+
+        let mut pcr_count = 0;
+        let mut af_data_count = 0;
+        for buf in buf.chunks(PACKET_LENGTH) {
+            let p = Packet::decode(buf).unwrap();
+            let summary = PacketSummary::decode(buf).unwrap();
+            let af = p.adaptation_field.as_ref();
+            assert_eq!(summary.packet_id, p.packet_id);
+            assert_eq!(summary.payload_unit_start_indicator, p.payload_unit_start_indicator);
+            assert_eq!(summary.random_access_indicator, af.and_then(|af| af.random_access_indicator).unwrap_or(false));
+            assert_eq!(summary.program_clock_reference_27mhz, af.and_then(|af| af.program_clock_reference_27mhz));
+            if af
+                .map(|af| !af.private_data_bytes.is_empty() || !af.temi_timeline_descriptors.is_empty())
+                .unwrap_or(false)
+            {
+                assert!(summary.has_adaptation_field_data);
+            }
+            pcr_count += summary.program_clock_reference_27mhz.is_some() as usize;
+            af_data_count += summary.has_adaptation_field_data as usize;
+        }
+        assert!(pcr_count > 0);
+        assert!(af_data_count > 0);
+
+        assert!(PacketSummary::decode(&[0; PACKET_LENGTH]).is_err());
+    }
+
     #[test]
     fn test_decode_encode() {
         let mut f = File::open("src/testdata/pro-bowl.ts").unwrap();
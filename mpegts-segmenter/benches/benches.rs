@@ -1,20 +1,62 @@
-use criterion::{criterion_group, criterion_main, Criterion};
+use criterion::{criterion_group, criterion_main, Criterion, Throughput};
 use mpeg2::ts;
-use std::{fs::File, io::Read};
+use mpegts_segmenter::{MemorySegmentStorage, Segmenter, SegmenterConfig, VideoParsing};
+use std::{fs::File, io::Read, time::Duration};
 
 fn criterion_benchmark(c: &mut Criterion) {
-    c.bench_function("analyzer", |b| {
-        let mut f = File::open("src/testdata/h264-8k.ts").unwrap();
+    let mut group = c.benchmark_group("analyzer");
+
+    for path in &["src/testdata/h264-8k.ts", "src/testdata/h265.ts"] {
+        let mut f = File::open(path).unwrap();
         let mut buf = Vec::new();
         f.read_to_end(&mut buf).unwrap();
         let packets = ts::decode_packets(&buf).unwrap();
+        group.throughput(Throughput::Bytes(buf.len() as _));
+
+        for &video_parsing in &[VideoParsing::Reassembled, VideoParsing::Selective] {
+            group.bench_function(format!("{}/{:?}", path.trim_start_matches("src/testdata/"), video_parsing), |b| {
+                b.iter(|| {
+                    let mut analyzer = mpegts_segmenter::Analyzer::with_video_parsing(video_parsing);
+                    analyzer.handle_packets(&packets).unwrap();
+                    analyzer.flush().unwrap();
+                })
+            });
+        }
+    }
+
+    group.finish();
+
+    let mut group = c.benchmark_group("segmenter");
+    let rt = tokio::runtime::Builder::new_current_thread().build().unwrap();
+
+    for path in &["src/testdata/h264-8k.ts", "src/testdata/h265.ts"] {
+        let mut f = File::open(path).unwrap();
+        let mut buf = Vec::new();
+        f.read_to_end(&mut buf).unwrap();
+        group.throughput(Throughput::Bytes(buf.len() as _));
+
+        // 7 packets is a typical SRT payload. The others simulate larger reads of about 16 and 64 KiB.
+        for &write_size in &[ts::PACKET_LENGTH * 7, ts::PACKET_LENGTH * 87, ts::PACKET_LENGTH * 348] {
+            group.bench_function(format!("{}/{}", path.trim_start_matches("src/testdata/"), write_size), |b| {
+                b.iter(|| {
+                    rt.block_on(async {
+                        let mut segmenter = Segmenter::new(
+                            SegmenterConfig {
+                                min_segment_duration: Duration::from_secs(2),
+                            },
+                            MemorySegmentStorage::new(),
+                        );
+                        for chunk in buf.chunks(write_size) {
+                            segmenter.write(chunk).await.unwrap();
+                        }
+                        segmenter.flush().await.unwrap();
+                    })
+                })
+            });
+        }
+    }
 
-        b.iter(|| {
-            let mut analyzer = mpegts_segmenter::Analyzer::new();
-            analyzer.handle_packets(&packets).unwrap();
-            analyzer.flush().unwrap();
-        })
-    });
+    group.finish();
 }
 
 criterion_group!(benches, criterion_benchmark);
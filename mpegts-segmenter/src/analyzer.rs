@@ -2,7 +2,7 @@ use mpeg2::{pes, ts};
 use mpeg4::AudioDataTransportStream;
 use vecmap::VecMap;
 
-use std::{collections::VecDeque, error::Error};
+use std::{collections::VecDeque, convert::Infallible, error::Error};
 
 pub type Result<T> = std::result::Result<T, Box<dyn Error + Send + Sync>>;
 
@@ -21,6 +21,180 @@ pub struct VideoMetadata {
     pub private_data: Vec<u8>,
 }
 
+/// Controls how the analyzer processes video PES packets.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum VideoParsing {
+    /// Each PES packet is copied into a contiguous buffer, then each of its NALs is parsed.
+    Reassembled,
+    /// PES packets are never reassembled. Their payloads pass through a small window that is scanned
+    /// for NALs whenever it fills up, and only the NALs that need to be decoded in full (parameter
+    /// sets and SEI) are retained. For everything else, just enough is retained to count access
+    /// units. This keeps memory use flat regardless of PES packet size. This is the default.
+    Selective,
+}
+
+impl Default for VideoParsing {
+    fn default() -> Self {
+        Self::Selective
+    }
+}
+
+// The most an H.264 slice needs for access unit counting: a header byte, three exp-golomb codes, a
+// colour plane id, and a frame number, with room for emulation prevention bytes.
+const H264_NALU_PREFIX_LEN: usize = 64;
+
+// The most an H.265 slice needs for access unit counting: a two byte header and a flag.
+const H265_NALU_PREFIX_LEN: usize = 3;
+
+// Scanning each transport packet payload on its own costs more than copying it, so payloads are
+// gathered into a window of about this size first.
+const SCAN_WINDOW_LEN: usize = 16 * 1024;
+
+/// SelectivePES is the state used to analyze video streams with [`VideoParsing::Selective`].
+#[derive(Clone)]
+pub struct SelectivePES {
+    pes: pes::ChunkedStream,
+    nalus: h264::AnnexBScanner,
+    // the current packet's data that hasn't been scanned yet
+    window: Vec<u8>,
+    // packets with bounded lengths are discarded if they're cut off, so the nals retained from them
+    // are held until they're complete. this is the header of the current packet if it's bounded
+    bounded_header: Option<pes::PacketHeader>,
+    bounded_nalus: HeldNALUs,
+}
+
+/// The NALs retained from a PES packet, stored back to back.
+#[derive(Clone, Default)]
+struct HeldNALUs {
+    data: Vec<u8>,
+    ends: Vec<usize>,
+}
+
+impl HeldNALUs {
+    fn push(&mut self, nalu: &[u8]) {
+        self.data.extend_from_slice(nalu);
+        self.ends.push(self.data.len());
+    }
+
+    // Adapts push to the scanner's fallible callbacks.
+    fn push_infallible(&mut self, nalu: &[u8]) -> std::result::Result<(), Infallible> {
+        self.push(nalu);
+        Ok(())
+    }
+
+    fn iter(&self) -> impl Iterator<Item = &[u8]> {
+        let starts = std::iter::once(0).chain(self.ends.iter().copied());
+        starts.zip(&self.ends).map(move |(start, &end)| &self.data[start..end])
+    }
+
+    fn clear(&mut self) {
+        self.data.clear();
+        self.ends.clear();
+    }
+}
+
+impl SelectivePES {
+    fn new(nalus: h264::AnnexBScanner) -> Self {
+        Self {
+            pes: pes::ChunkedStream::new(),
+            nalus,
+            window: Vec::with_capacity(SCAN_WINDOW_LEN),
+            bounded_header: None,
+            bounded_nalus: HeldNALUs::default(),
+        }
+    }
+
+    fn h264() -> Self {
+        Self::new(h264::AnnexBScanner::new(H264_NALU_PREFIX_LEN, |b| {
+            matches!(
+                b & h264::NAL_UNIT_TYPE_MASK,
+                h264::NAL_UNIT_TYPE_SEQUENCE_PARAMETER_SET | h264::NAL_UNIT_TYPE_SUPPLEMENTAL_ENHANCEMENT_INFORMATION
+            )
+        }))
+    }
+
+    fn h265() -> Self {
+        Self::new(h265::AnnexBScanner::new(H265_NALU_PREFIX_LEN, |b| {
+            matches!((b >> 1) & 0x3f, h265::NAL_UNIT_TYPE_VPS_NUT | h265::NAL_UNIT_TYPE_SPS_NUT)
+        }))
+    }
+
+    fn write(&mut self, stream: &mut Stream, packet: &ts::Packet) -> Result<()> {
+        let result = self.pes.write(packet).map_err(|e| e.into()).and_then(|chunks| {
+            for chunk in chunks {
+                self.handle_chunk(stream, chunk)?;
+            }
+            Ok(())
+        });
+        if result.is_err() {
+            // skip the rest of the pes packet, as if it had been reassembled and failed to parse
+            self.pes.flush();
+            self.discard();
+        }
+        result
+    }
+
+    fn flush(&mut self, stream: &mut Stream) -> Result<()> {
+        let result = match self.pes.flush() {
+            Some(chunk) => self.handle_chunk(stream, chunk),
+            None => Ok(()),
+        };
+        if result.is_err() {
+            self.discard();
+        }
+        result
+    }
+
+    fn handle_chunk(&mut self, stream: &mut Stream, chunk: pes::Chunk) -> Result<()> {
+        match chunk {
+            // unbounded packets are always completed, so they can be handled as they arrive
+            pes::Chunk::Start(header) if header.data_length == 0 => stream.handle_pes_header(&header),
+            pes::Chunk::Start(header) => self.bounded_header = Some(header),
+            pes::Chunk::Data(data) => {
+                if self.window.len() + data.len() > SCAN_WINDOW_LEN {
+                    self.scan_window(stream)?;
+                }
+                self.window.extend_from_slice(data);
+            }
+            pes::Chunk::End => {
+                self.scan_window(stream)?;
+                match self.bounded_header.take() {
+                    None => self.nalus.finish(|nalu| stream.handle_nalu(nalu))?,
+                    Some(header) => {
+                        let held = &mut self.bounded_nalus;
+                        self.nalus.finish(|nalu| held.push_infallible(nalu)).unwrap_or_else(|e| match e {});
+                        stream.handle_pes_header(&header);
+                        for nalu in held.iter() {
+                            stream.handle_nalu(nalu)?;
+                        }
+                        held.clear();
+                    }
+                }
+            }
+            pes::Chunk::Discard => self.discard(),
+        }
+        Ok(())
+    }
+
+    fn scan_window(&mut self, stream: &mut Stream) -> Result<()> {
+        if self.bounded_header.is_none() {
+            self.nalus.write(&self.window, |nalu| stream.handle_nalu(nalu))?;
+        } else {
+            let held = &mut self.bounded_nalus;
+            self.nalus.write(&self.window, |nalu| held.push_infallible(nalu)).unwrap_or_else(|e| match e {});
+        }
+        self.window.clear();
+        Ok(())
+    }
+
+    fn discard(&mut self) {
+        self.window.clear();
+        self.bounded_header = None;
+        self.bounded_nalus.clear();
+        self.nalus.reset();
+    }
+}
+
 #[allow(clippy::large_enum_variant)]
 #[derive(Clone)]
 pub enum Stream {
@@ -34,6 +208,7 @@ pub enum Stream {
     },
     AVCVideo {
         pes: pes::Stream,
+        selective_pes: Option<Box<SelectivePES>>,
         width: u32,
         height: u32,
         frame_rate: f64,
@@ -48,6 +223,7 @@ pub enum Stream {
     },
     HEVCVideo {
         pes: pes::Stream,
+        selective_pes: Option<Box<SelectivePES>>,
         width: u32,
         height: u32,
         frame_rate: f64,
@@ -156,6 +332,30 @@ impl Stream {
                     data = &data[adts.frame_length..];
                 }
             }
+            Self::AVCVideo { .. } | Self::HEVCVideo { .. } => {
+                self.handle_pes_header(&packet.header);
+                for nalu in h264::iterate_annex_b(&packet.data) {
+                    if !nalu.is_empty() {
+                        self.handle_nalu(nalu)?;
+                    }
+                }
+            }
+            _ => {}
+        }
+        Ok(())
+    }
+
+    fn handle_pes_header(&mut self, header: &pes::PacketHeader) {
+        if let Self::AVCVideo { pts_analyzer, .. } | Self::HEVCVideo { pts_analyzer, .. } = self {
+            match header.optional_header.as_ref().and_then(|h| h.pts) {
+                Some(pts) => pts_analyzer.write_pts(pts),
+                None => pts_analyzer.reset(),
+            }
+        }
+    }
+
+    fn handle_nalu(&mut self, nalu: &[u8]) -> Result<()> {
+        match self {
             Self::AVCVideo {
                 width,
                 height,
@@ -166,100 +366,88 @@ impl Stream {
                 timecode,
                 last_timecode,
                 last_vui_parameters,
-                pts_analyzer,
                 ..
             } => {
-                match packet.header.optional_header.and_then(|h| h.pts) {
-                    Some(pts) => pts_analyzer.write_pts(pts),
-                    None => pts_analyzer.reset(),
-                }
-
                 use h264::Decode;
 
-                for nalu in h264::iterate_annex_b(&packet.data) {
-                    if nalu.is_empty() {
-                        continue;
+                access_unit_counter.count_nalu(nalu)?;
+
+                let nalu_type = nalu[0] & h264::NAL_UNIT_TYPE_MASK;
+                match nalu_type {
+                    h264::NAL_UNIT_TYPE_SEQUENCE_PARAMETER_SET => {
+                        let bs = h264::Bitstream::new(nalu.iter().copied());
+                        let mut nalu = h264::NALUnit::decode(bs)?;
+                        *rfc6381_codec = rfc6381::codec_from_h264_nalu(nalu.clone());
+                        let mut rbsp = h264::Bitstream::new(&mut nalu.rbsp_byte);
+                        let sps = h264::SequenceParameterSet::decode(&mut rbsp)?;
+                        *is_interlaced = sps.frame_mbs_only_flag.0 == 0;
+                        *width = sps.frame_cropping_rectangle_width() as _;
+                        *height = sps.frame_cropping_rectangle_height() as _;
+                        if sps.vui_parameters_present_flag.0 != 0
+                            && sps.vui_parameters.timing_info_present_flag.0 != 0
+                            && sps.vui_parameters.num_units_in_tick.0 != 0
+                        {
+                            *frame_rate =
+                                (sps.vui_parameters.time_scale.0 as f64 / (2.0 * sps.vui_parameters.num_units_in_tick.0 as f64) * 100.0).round() / 100.0;
+                        } else {
+                            // if the frame rate is later requested we'll try to guess it via the PTS analyzer
+                            *frame_rate = 0.0;
+                        }
+                        *last_vui_parameters = Some(sps.vui_parameters);
                     }
+                    h264::NAL_UNIT_TYPE_SUPPLEMENTAL_ENHANCEMENT_INFORMATION => {
+                        let bs = h264::Bitstream::new(nalu.iter().copied());
+                        let mut nalu = h264::NALUnit::decode(bs)?;
 
-                    access_unit_counter.count_nalu(nalu)?;
-
-                    let nalu_type = nalu[0] & h264::NAL_UNIT_TYPE_MASK;
-                    match nalu_type {
-                        h264::NAL_UNIT_TYPE_SEQUENCE_PARAMETER_SET => {
-                            let bs = h264::Bitstream::new(nalu.iter().copied());
-                            let mut nalu = h264::NALUnit::decode(bs)?;
-                            *rfc6381_codec = rfc6381::codec_from_h264_nalu(nalu.clone());
+                        if let Some(vui_params) = &last_vui_parameters {
                             let mut rbsp = h264::Bitstream::new(&mut nalu.rbsp_byte);
-                            let sps = h264::SequenceParameterSet::decode(&mut rbsp)?;
-                            *is_interlaced = sps.frame_mbs_only_flag.0 == 0;
-                            *width = sps.frame_cropping_rectangle_width() as _;
-                            *height = sps.frame_cropping_rectangle_height() as _;
-                            if sps.vui_parameters_present_flag.0 != 0
-                                && sps.vui_parameters.timing_info_present_flag.0 != 0
-                                && sps.vui_parameters.num_units_in_tick.0 != 0
-                            {
-                                *frame_rate =
-                                    (sps.vui_parameters.time_scale.0 as f64 / (2.0 * sps.vui_parameters.num_units_in_tick.0 as f64) * 100.0).round() / 100.0;
-                            } else {
-                                // if the frame rate is later requested we'll try to guess it via the PTS analyzer
-                                *frame_rate = 0.0;
-                            }
-                            *last_vui_parameters = Some(sps.vui_parameters);
-                        }
-                        h264::NAL_UNIT_TYPE_SUPPLEMENTAL_ENHANCEMENT_INFORMATION => {
-                            let bs = h264::Bitstream::new(nalu.iter().copied());
-                            let mut nalu = h264::NALUnit::decode(bs)?;
-
-                            if let Some(vui_params) = &last_vui_parameters {
-                                let mut rbsp = h264::Bitstream::new(&mut nalu.rbsp_byte);
-                                let sei = h264::SEI::decode(&mut rbsp)?;
-
-                                let mut pic_timings = vec![];
-                                for message in sei.sei_message {
-                                    if message.payload_type != h264::SEI_PAYLOAD_TYPE_PIC_TIMING {
-                                        continue;
-                                    }
-                                    let mut bs = h264::Bitstream::new(message.payload);
-                                    let timing = h264::PicTiming::decode(&mut bs, vui_params)?;
-                                    pic_timings.extend_from_slice(timing.timecodes.as_slice());
+                            let sei = h264::SEI::decode(&mut rbsp)?;
+
+                            let mut pic_timings = vec![];
+                            for message in sei.sei_message {
+                                if message.payload_type != h264::SEI_PAYLOAD_TYPE_PIC_TIMING {
+                                    continue;
                                 }
+                                let mut bs = h264::Bitstream::new(message.payload);
+                                let timing = h264::PicTiming::decode(&mut bs, vui_params)?;
+                                pic_timings.extend_from_slice(timing.timecodes.as_slice());
+                            }
 
-                                let timecodes: Vec<Timecode> = last_timecode.iter().cloned().collect();
-                                let timecodes = pic_timings.iter().fold(timecodes, |mut timecodes, t| {
-                                    let mut timecode = Timecode {
-                                        hours: t.hours.0,
-                                        minutes: t.minutes.0,
-                                        seconds: t.seconds.0,
-                                        frames: t.n_frames.0,
-                                    };
-                                    if let Some(previous_timecode) = timecodes.last() {
-                                        if t.full_timestamp_flag.0 == 0 {
-                                            if t.seconds_flag.0 == 0 {
-                                                timecode.seconds = previous_timecode.seconds;
-                                                timecode.minutes = previous_timecode.minutes;
-                                                timecode.hours = previous_timecode.hours;
-                                            } else if t.minutes_flag.0 == 0 {
-                                                timecode.minutes = previous_timecode.minutes;
-                                                timecode.hours = previous_timecode.hours;
-                                            } else if t.hours_flag.0 == 0 {
-                                                timecode.hours = previous_timecode.hours;
-                                            }
+                            let timecodes: Vec<Timecode> = last_timecode.iter().cloned().collect();
+                            let timecodes = pic_timings.iter().fold(timecodes, |mut timecodes, t| {
+                                let mut timecode = Timecode {
+                                    hours: t.hours.0,
+                                    minutes: t.minutes.0,
+                                    seconds: t.seconds.0,
+                                    frames: t.n_frames.0,
+                                };
+                                if let Some(previous_timecode) = timecodes.last() {
+                                    if t.full_timestamp_flag.0 == 0 {
+                                        if t.seconds_flag.0 == 0 {
+                                            timecode.seconds = previous_timecode.seconds;
+                                            timecode.minutes = previous_timecode.minutes;
+                                            timecode.hours = previous_timecode.hours;
+                                        } else if t.minutes_flag.0 == 0 {
+                                            timecode.minutes = previous_timecode.minutes;
+                                            timecode.hours = previous_timecode.hours;
+                                        } else if t.hours_flag.0 == 0 {
+                                            timecode.hours = previous_timecode.hours;
                                         }
                                     }
-                                    timecodes.push(timecode);
-                                    timecodes
-                                });
-                                let last = timecodes.iter().last();
-                                if let Some(last) = last {
-                                    if timecode.is_none() {
-                                        *timecode = Some(last.clone());
-                                    }
-                                    *last_timecode = Some(last.clone());
                                 }
+                                timecodes.push(timecode);
+                                timecodes
+                            });
+                            let last = timecodes.iter().last();
+                            if let Some(last) = last {
+                                if timecode.is_none() {
+                                    *timecode = Some(last.clone());
+                                }
+                                *last_timecode = Some(last.clone());
                             }
                         }
-                        _ => {}
                     }
+                    _ => {}
                 }
             }
             Self::HEVCVideo {
@@ -268,60 +456,48 @@ impl Stream {
                 frame_rate,
                 rfc6381_codec,
                 access_unit_counter,
-                pts_analyzer,
                 ..
             } => {
-                match packet.header.optional_header.and_then(|h| h.pts) {
-                    Some(pts) => pts_analyzer.write_pts(pts),
-                    None => pts_analyzer.reset(),
-                }
-
                 use h265::Decode;
 
-                for nalu in h265::iterate_annex_b(&packet.data) {
-                    if nalu.is_empty() {
-                        continue;
-                    }
-
-                    access_unit_counter.count_nalu(nalu)?;
-
-                    let mut bs = h265::Bitstream::new(nalu.iter().copied());
-                    let header = h265::NALUnitHeader::decode(&mut bs)?;
-
-                    match header.nal_unit_type.0 {
-                        h265::NAL_UNIT_TYPE_SPS_NUT => {
-                            let bs = h265::Bitstream::new(nalu.iter().copied());
-                            let mut nalu = h265::NALUnit::decode(bs)?;
-                            *rfc6381_codec = rfc6381::codec_from_h265_nalu(nalu.clone());
-                            let mut rbsp = h265::Bitstream::new(&mut nalu.rbsp_byte);
-                            let sps = h265::SequenceParameterSet::decode(&mut rbsp)?;
-                            *width = sps.croppedWidth() as _;
-                            *height = sps.croppedHeight() as _;
-                            if sps.vui_parameters_present_flag.0 != 0
-                                && sps.vui_parameters.vui_timing_info_present_flag.0 != 0
-                                && sps.vui_parameters.vui_num_units_in_tick.0 != 0
-                            {
-                                *frame_rate =
-                                    (sps.vui_parameters.vui_time_scale.0 as f64 / sps.vui_parameters.vui_num_units_in_tick.0 as f64 * 100.0).round() / 100.0;
-                            } else {
-                                // if the frame rate is later requested we'll try to guess it via the PTS analyzer
-                                *frame_rate = 0.0;
-                            }
+                access_unit_counter.count_nalu(nalu)?;
+
+                let mut bs = h265::Bitstream::new(nalu.iter().copied());
+                let header = h265::NALUnitHeader::decode(&mut bs)?;
+
+                match header.nal_unit_type.0 {
+                    h265::NAL_UNIT_TYPE_SPS_NUT => {
+                        let bs = h265::Bitstream::new(nalu.iter().copied());
+                        let mut nalu = h265::NALUnit::decode(bs)?;
+                        *rfc6381_codec = rfc6381::codec_from_h265_nalu(nalu.clone());
+                        let mut rbsp = h265::Bitstream::new(&mut nalu.rbsp_byte);
+                        let sps = h265::SequenceParameterSet::decode(&mut rbsp)?;
+                        *width = sps.croppedWidth() as _;
+                        *height = sps.croppedHeight() as _;
+                        if sps.vui_parameters_present_flag.0 != 0
+                            && sps.vui_parameters.vui_timing_info_present_flag.0 != 0
+                            && sps.vui_parameters.vui_num_units_in_tick.0 != 0
+                        {
+                            *frame_rate =
+                                (sps.vui_parameters.vui_time_scale.0 as f64 / sps.vui_parameters.vui_num_units_in_tick.0 as f64 * 100.0).round() / 100.0;
+                        } else {
+                            // if the frame rate is later requested we'll try to guess it via the PTS analyzer
+                            *frame_rate = 0.0;
                         }
-                        h265::NAL_UNIT_TYPE_VPS_NUT => {
-                            let bs = h265::Bitstream::new(nalu.iter().copied());
-                            let mut nalu = h265::NALUnit::decode(bs)?;
-                            let mut rbsp = h265::Bitstream::new(&mut nalu.rbsp_byte);
-                            let vps = h265::VideoParameterSet::decode(&mut rbsp)?;
-                            if vps.vps_timing_info_present_flag.0 != 0 {
-                                *frame_rate = match vps.vps_num_units_in_tick.0 {
-                                    0 => 0.0,
-                                    num_units_in_tick => (vps.vps_time_scale.0 as f64 / num_units_in_tick as f64 * 100.0).round() / 100.0,
-                                };
-                            }
+                    }
+                    h265::NAL_UNIT_TYPE_VPS_NUT => {
+                        let bs = h265::Bitstream::new(nalu.iter().copied());
+                        let mut nalu = h265::NALUnit::decode(bs)?;
+                        let mut rbsp = h265::Bitstream::new(&mut nalu.rbsp_byte);
+                        let vps = h265::VideoParameterSet::decode(&mut rbsp)?;
+                        if vps.vps_timing_info_present_flag.0 != 0 {
+                            *frame_rate = match vps.vps_num_units_in_tick.0 {
+                                0 => 0.0,
+                                num_units_in_tick => (vps.vps_time_scale.0 as f64 / num_units_in_tick as f64 * 100.0).round() / 100.0,
+                            };
                         }
-                        _ => {}
                     }
+                    _ => {}
                 }
             }
             _ => {}
@@ -362,7 +538,29 @@ impl Stream {
         }
     }
 
+    fn selective_pes(&mut self) -> Option<&mut Option<Box<SelectivePES>>> {
+        match self {
+            Self::AVCVideo { selective_pes, .. } => Some(selective_pes),
+            Self::HEVCVideo { selective_pes, .. } => Some(selective_pes),
+            _ => None,
+        }
+    }
+
+    // The selective pes state is taken out of the stream while it's in use so that it can pass NALs
+    // back to the stream.
+    fn with_selective_pes<F: FnOnce(&mut SelectivePES, &mut Self) -> Result<()>>(&mut self, f: F) -> Option<Result<()>> {
+        let mut selective_pes = self.selective_pes()?.take()?;
+        let result = f(&mut selective_pes, self);
+        if let Some(slot) = self.selective_pes() {
+            *slot = Some(selective_pes);
+        }
+        Some(result)
+    }
+
     pub fn write(&mut self, packet: &ts::Packet) -> Result<()> {
+        if let Some(result) = self.with_selective_pes(|selective_pes, stream| selective_pes.write(stream, packet)) {
+            return result;
+        }
         if let Some(pes) = self.pes() {
             for packet in pes.write(packet)? {
                 self.handle_pes_packet(packet)?;
@@ -372,6 +570,9 @@ impl Stream {
     }
 
     pub fn flush(&mut self) -> Result<()> {
+        if let Some(result) = self.with_selective_pes(|selective_pes, stream| selective_pes.flush(stream)) {
+            return result;
+        }
         if let Some(pes) = self.pes() {
             for packet in pes.flush() {
                 self.handle_pes_packet(packet)?;
@@ -413,10 +614,15 @@ enum PidState {
 pub struct Analyzer {
     pids: VecMap<u16, PidState>,
     has_video: bool,
+    video_parsing: VideoParsing,
 }
 
 impl Analyzer {
     pub fn new() -> Self {
+        Self::with_video_parsing(VideoParsing::default())
+    }
+
+    pub fn with_video_parsing(video_parsing: VideoParsing) -> Self {
         Self {
             pids: {
                 let mut v = VecMap::new();
@@ -424,6 +630,7 @@ impl Analyzer {
                 v
             },
             has_video: false,
+            video_parsing,
         }
     }
 
@@ -434,6 +641,12 @@ impl Analyzer {
         Ok(())
     }
 
+    /// Returns true if packets with the given PID need to be passed to the analyzer. Packets for
+    /// any other PID are ignored by [`Analyzer::handle_packet`] (until a PAT or PMT says otherwise).
+    pub fn handles_pid(&self, pid: u16) -> bool {
+        self.pids.contains_key(&pid)
+    }
+
     pub fn is_pes(&self, pid: u16) -> bool {
         matches!(self.pids.get(&pid), Some(PidState::Pes { .. }))
     }
@@ -523,6 +736,10 @@ impl Analyzer {
                             },
                             0x1b => Stream::AVCVideo {
                                 pes: pes::Stream::new(),
+                                selective_pes: match self.video_parsing {
+                                    VideoParsing::Reassembled => None,
+                                    VideoParsing::Selective => Some(Box::new(SelectivePES::h264())),
+                                },
                                 width: 0,
                                 height: 0,
                                 frame_rate: 0.0,
@@ -537,6 +754,10 @@ impl Analyzer {
                             },
                             0x24 => Stream::HEVCVideo {
                                 pes: pes::Stream::new(),
+                                selective_pes: match self.video_parsing {
+                                    VideoParsing::Reassembled => None,
+                                    VideoParsing::Selective => Some(Box::new(SelectivePES::h265())),
+                                },
                                 width: 0,
                                 height: 0,
                                 frame_rate: 0.0,
@@ -993,6 +1214,33 @@ mod test {
         );
     }
 
+    #[tokio::test]
+    async fn test_analyzer_video_parsing() {
+        for path in &[
+            "src/testdata/h264.ts",
+            "src/testdata/h264-8k.ts",
+            "src/testdata/h265.ts",
+            "src/testdata/h265-8k.ts",
+            "src/testdata/program.ts",
+            "src/testdata/temi-timeline-ntp-ts.ts",
+        ] {
+            let mut f = File::open(path).unwrap();
+            let mut buf = Vec::new();
+            f.read_to_end(&mut buf).unwrap();
+            let packets = ts::decode_packets(&buf).unwrap();
+
+            let mut reassembled = Analyzer::with_video_parsing(VideoParsing::Reassembled);
+            reassembled.handle_packets(&packets).unwrap();
+            reassembled.flush().unwrap();
+
+            let mut selective = Analyzer::with_video_parsing(VideoParsing::Selective);
+            selective.handle_packets(&packets).unwrap();
+            selective.flush().unwrap();
+
+            assert_eq!(selective.streams(), reassembled.streams(), "{}", path);
+        }
+    }
+
     #[test]
     fn test_pts_analyzer_b_frames() {
         let mut analyzer = PTSAnalyzer::new();
@@ -3,10 +3,10 @@ use crate::VideoMetadata;
 use mpeg2::{
     pes,
     temi::TEMITimelineDescriptor,
-    ts::{Packet, PACKET_LENGTH},
+    ts::{Packet, PacketSummary, PACKET_LENGTH},
 };
 use pretty_hex::PrettyHex;
-use std::{fmt, io, time::Duration};
+use std::{fmt, io, ops::Range, time::Duration};
 use tokio::io::{AsyncRead, AsyncReadExt, AsyncWrite, AsyncWriteExt};
 
 pub const PTS_ROLLOVER_MOD: u64 = 1 << 33;
@@ -82,6 +82,11 @@ pub struct Segmenter<S: SegmentStorage> {
 
     /// Current byte position in the overall stream.
     pos: usize,
+
+    /// The start of a packet that was split across writes.
+    partial_packet: Vec<u8>,
+    /// Reused by each write to summarize its packets.
+    packet_index: Vec<PacketSummary>,
 }
 
 impl<S: SegmentStorage> Segmenter<S> {
@@ -96,6 +101,8 @@ impl<S: SegmentStorage> Segmenter<S> {
             previous_segment: None,
             previous_segment_info: None,
             pos: 0,
+            partial_packet: Vec::with_capacity(PACKET_LENGTH),
+            packet_index: Vec::new(),
         }
     }
 
@@ -107,14 +114,93 @@ impl<S: SegmentStorage> Segmenter<S> {
         &mut self.storage
     }
 
-    /// Writes packets to the segmenter. The segmenter does not do any internal buffering, so buf
-    /// must be divisible by 188 (the MPEG TS packet length).
-    pub async fn write(&mut self, buf: &[u8]) -> Result<(), Error> {
-        if buf.len() % PACKET_LENGTH != 0 {
-            return Err(io::Error::new(io::ErrorKind::Other, "write length not divisible by packet length").into());
+    /// Writes bytes to the segmenter. buf doesn't need to be aligned to packet boundaries: if it
+    /// ends with a partial packet, those bytes are buffered and completed by the next write.
+    ///
+    /// Packets are written to segments in runs, so each call results in at most one write per
+    /// segment it touches.
+    pub async fn write(&mut self, mut buf: &[u8]) -> Result<(), Error> {
+        if !self.partial_packet.is_empty() {
+            let n = (PACKET_LENGTH - self.partial_packet.len()).min(buf.len());
+            self.partial_packet.extend_from_slice(&buf[..n]);
+            buf = &buf[n..];
+            if self.partial_packet.len() < PACKET_LENGTH {
+                return Ok(());
+            }
+            let packet = std::mem::take(&mut self.partial_packet);
+            let result = self.write_packets(&packet).await;
+            self.partial_packet = packet;
+            self.partial_packet.clear();
+            result?;
+        }
+
+        let aligned_len = buf.len() - buf.len() % PACKET_LENGTH;
+        self.partial_packet.extend_from_slice(&buf[aligned_len..]);
+        self.write_packets(&buf[..aligned_len]).await
+    }
+
+    async fn write_packets(&mut self, buf: &[u8]) -> Result<(), Error> {
+        // Start with a cheap pass over the fixed offsets of each packet. This stops at the first
+        // packet that can't be decoded, which is handled once everything before it is processed.
+        let mut packet_index = std::mem::take(&mut self.packet_index);
+        packet_index.clear();
+        packet_index.extend(buf.chunks_exact(PACKET_LENGTH).map_while(|buf| PacketSummary::decode(buf).ok()));
+
+        let mut run = 0..0;
+        let result = self.write_indexed_packets(buf, &packet_index, &mut run).await;
+        let bad_packet_offset = packet_index.len() * PACKET_LENGTH;
+        self.packet_index = packet_index;
+
+        // Whatever happened, packets that have already been processed belong in the segment.
+        self.write_run(buf, &mut run).await?;
+        result?;
+
+        if bad_packet_offset < buf.len() {
+            let buf = &buf[bad_packet_offset..bad_packet_offset + PACKET_LENGTH];
+            if let Err(e) = Packet::decode(buf) {
+                return Err(Error::Mpeg2TsDecode {
+                    packet_pos: self.pos,
+                    inner: e,
+                    pkt: buf.to_owned(),
+                });
+            }
+        }
+
+        Ok(())
+    }
+
+    /// Writes the pending run of packets, buf[run], to the current segment.
+    async fn write_run(&mut self, buf: &[u8], run: &mut Range<usize>) -> Result<(), Error> {
+        if run.start < run.end {
+            if let Some(segment) = &mut self.current_segment {
+                segment.segment.write_all(&buf[run.clone()]).await?;
+                segment.bytes_written += run.len();
+            }
         }
+        run.start = run.end;
+        Ok(())
+    }
+
+    /// Processes the packets in batch. Rather than writing each packet to the current segment
+    /// directly, this extends the pending run, which must be written before starting a new one.
+    ///
+    /// This is one loop rather than an async function per packet, so that the future's state isn't
+    /// moved around for every packet.
+    async fn write_indexed_packets(&mut self, batch: &[u8], packet_index: &[PacketSummary], run: &mut Range<usize>) -> Result<(), Error> {
+        for (i, summary) in packet_index.iter().enumerate() {
+            let offset = i * PACKET_LENGTH;
+            let buf = &batch[offset..offset + PACKET_LENGTH];
+
+            // Only do a full decode if the analyzer or the adaptation field handling below need it.
+            if !self.analyzer.handles_pid(summary.packet_id) && !summary.has_adaptation_field_data {
+                self.pcr = summary.program_clock_reference_27mhz.or(self.pcr);
+                if self.current_segment.is_some() {
+                    extend_run(run, offset);
+                }
+                self.pos += PACKET_LENGTH;
+                continue;
+            }
 
-        for buf in buf.chunks(PACKET_LENGTH) {
             let p = Packet::decode(buf).map_err(|e| Error::Mpeg2TsDecode {
                 packet_pos: self.pos,
                 inner: e,
@@ -122,9 +208,7 @@ impl<S: SegmentStorage> Segmenter<S> {
             })?;
             self.analyzer.handle_packet(&p)?;
 
-            if let Some(af) = &p.adaptation_field {
-                self.pcr = af.program_clock_reference_27mhz.or(self.pcr);
-            }
+            self.pcr = summary.program_clock_reference_27mhz.or(self.pcr);
 
             let mut should_start_new_segment = false;
             if self.analyzer.is_pes(p.packet_id) {
@@ -136,7 +220,7 @@ impl<S: SegmentStorage> Segmenter<S> {
                                 && (elapsed_seconds < -1.0 || elapsed_seconds >= self.config.min_segment_duration.as_secs_f64())
                             {
                                 // start a new segment if this is a keyframe
-                                if p.adaptation_field.as_ref().and_then(|af| af.random_access_indicator).unwrap_or(false) {
+                                if summary.random_access_indicator {
                                     true
                                 } else if let Some(payload) = &p.payload {
                                     // Some muxers don't set RAI bits. If possible, see if this
@@ -218,6 +302,7 @@ impl<S: SegmentStorage> Segmenter<S> {
             }
 
             if should_start_new_segment {
+                self.write_run(batch, run).await?;
                 if let Some(curr) = self.current_segment.take() {
                     self.previous_segment_info = Some(SegmentInfo::compile(&curr, self.analyzer.streams(), &self.streams_before_segment));
                     self.previous_segment = Some(curr);
@@ -278,8 +363,7 @@ impl<S: SegmentStorage> Segmenter<S> {
                     segment.temi_timeline_descriptor = first_temi_timeline_descriptor;
                 }
 
-                segment.segment.write_all(buf).await?;
-                segment.bytes_written += buf.len();
+                extend_run(run, offset);
             }
             self.pos += buf.len();
         }
@@ -288,6 +372,11 @@ impl<S: SegmentStorage> Segmenter<S> {
     }
 
     pub async fn flush(&mut self) -> Result<(), Error> {
+        if !self.partial_packet.is_empty() {
+            let len = self.partial_packet.len();
+            self.partial_packet.clear();
+            return Err(io::Error::new(io::ErrorKind::UnexpectedEof, format!("stream ended with a partial packet of {} bytes", len)).into());
+        }
         if let Some(segment) = self.current_segment.take() {
             let info = SegmentInfo::compile(&segment, self.analyzer.streams(), &self.streams_before_segment);
             self.storage.finalize_segment(segment.segment, info).await?;
@@ -299,8 +388,9 @@ impl<S: SegmentStorage> Segmenter<S> {
 pub async fn segment<R: AsyncRead + Unpin, S: SegmentStorage>(mut r: R, config: SegmenterConfig, storage: S) -> Result<(), Error> {
     let mut segmenter = Segmenter::new(config, storage);
 
-    // XXX: the buffer size should be at least 1316, which is the max SRT payload size
-    let mut buf = [0u8; PACKET_LENGTH * 20];
+    // Reads don't need to be aligned to packets, but larger ones let the segmenter coalesce more
+    // packets into each segment write.
+    let mut buf = vec![0u8; PACKET_LENGTH * 348];
 
     loop {
         let bytes_read = r.read(&mut buf).await?;
@@ -314,6 +404,14 @@ pub async fn segment<R: AsyncRead + Unpin, S: SegmentStorage>(mut r: R, config:
     Ok(())
 }
 
+/// Extends the run to include the packet at offset, starting a new run if it's empty.
+fn extend_run(run: &mut Range<usize>, offset: usize) {
+    if run.start == run.end {
+        *run = offset..offset;
+    }
+    run.end = offset + PACKET_LENGTH;
+}
+
 fn convert_to_relative_pts(video_metadata: &[VideoMetadata], first_pts: Option<u64>) -> Vec<VideoMetadata> {
     if video_metadata.is_empty() {
         vec![]
@@ -499,6 +597,49 @@ mod test {
         assert_eq!(segments.len(), durations.len() + 1);
     }
 
+    #[tokio::test]
+    async fn test_segmenter_unaligned_writes() {
+        let mut f = File::open("src/testdata/h264-8k.ts").unwrap();
+        let mut buf = Vec::new();
+        f.read_to_end(&mut buf).unwrap();
+
+        let mut segments = Vec::new();
+        for &write_size in &[PACKET_LENGTH, 1000, 1, 100_003] {
+            let mut segmenter = Segmenter::new(
+                SegmenterConfig {
+                    min_segment_duration: Duration::from_secs(1),
+                },
+                MemorySegmentStorage::new(),
+            );
+            for chunk in buf.chunks(write_size) {
+                segmenter.write(chunk).await.unwrap();
+            }
+            segmenter.flush().await.unwrap();
+            segments.push(
+                segmenter
+                    .storage()
+                    .segments()
+                    .iter()
+                    .map(|(data, info)| (data.clone(), info.size, info.presentation_time, info.duration))
+                    .collect::<Vec<_>>(),
+            );
+        }
+        assert_eq!(segments[0].len(), 2);
+        for other in &segments[1..] {
+            // not assert_eq, which would dump megabytes of segment data on failure
+            assert!(segments[0] == *other);
+        }
+
+        let mut segmenter = Segmenter::new(
+            SegmenterConfig {
+                min_segment_duration: Duration::from_secs(1),
+            },
+            MemorySegmentStorage::new(),
+        );
+        segmenter.write(&buf[..PACKET_LENGTH * 1000 + 1]).await.unwrap();
+        assert!(segmenter.flush().await.is_err());
+    }
+
     #[tokio::test]
     async fn test_segmenter_h265_8k() {
         let mut storage = MemorySegmentStorage::new();
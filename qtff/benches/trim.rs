@@ -0,0 +1,239 @@
+//! Benchmarks trimming many short clips out of one long synthetic movie, with output written to a
+//! temporary file.
+
+use byteorder::{BigEndian, WriteBytesExt};
+use criterion::{criterion_group, criterion_main, Criterion, Throughput};
+use qtff::{
+    data::{
+        ChunkOffset64Data, MediaHeaderData, MovieHeaderData, SampleSizeData, SampleToChunkData, SampleToChunkDataEntry, TimeToSampleData,
+        TimeToSampleDataEntry, TrackHeaderData,
+    },
+    AtomSize, AtomWriteExt, File, FourCC,
+};
+use std::{
+    io::{Seek, SeekFrom, Write},
+    path::Path,
+};
+
+const TIME_SCALE: u32 = 30_000;
+const SAMPLE_COUNT: u32 = 36_000;
+const SAMPLES_PER_CHUNK: u32 = 10;
+const CLIP_COUNT: u64 = 50;
+const CLIP_DURATION: u64 = 2 * TIME_SCALE as u64;
+
+/// Returns the size of the given sample. Sizes vary so that every sample size has to be looked up.
+fn sample_size(n: u32) -> u32 {
+    500 + (n.wrapping_mul(2_654_435_761) >> 21)
+}
+
+/// Returns the duration of the given sample. Durations alternate between runs of 1000 and 1001 so
+/// that the time-to-sample table has thousands of entries, like variable frame rate footage.
+fn sample_duration(n: u32) -> u32 {
+    if (n / 7) % 2 == 0 {
+        1000
+    } else {
+        1001
+    }
+}
+
+fn write_container<W: Write>(mut w: W, typ: &str, data: &[u8]) {
+    w.write_atom_header(FourCC::from_str(typ), data.len()).unwrap();
+    w.write_all(data).unwrap();
+}
+
+/// Writes a movie with a single generic media track of about 20 minutes.
+fn write_source(path: &Path) {
+    let mut f = std::fs::File::create(path).unwrap();
+
+    let mdat_size = (0..SAMPLE_COUNT).map(|n| sample_size(n) as u64).sum::<u64>();
+    f.write_atom_header(FourCC::from_str("mdat"), AtomSize::ExtendedSize(mdat_size)).unwrap();
+    let mut chunk_offsets = vec![];
+    let mut offset = 16;
+    for n in 0..SAMPLE_COUNT {
+        if n % SAMPLES_PER_CHUNK == 0 {
+            chunk_offsets.push(offset);
+        }
+        f.write_all(&vec![n as u8; sample_size(n) as usize]).unwrap();
+        offset += sample_size(n) as u64;
+    }
+
+    let mut time_to_sample = TimeToSampleData::default();
+    for n in 0..SAMPLE_COUNT {
+        match time_to_sample.entries.last_mut() {
+            Some(e) if e.sample_duration == sample_duration(n) => e.sample_count += 1,
+            _ => time_to_sample.entries.push(TimeToSampleDataEntry {
+                sample_count: 1,
+                sample_duration: sample_duration(n),
+            }),
+        }
+    }
+    let duration = time_to_sample.duration() as u32;
+
+    let mut stbl = vec![];
+    let mut stsd = vec![];
+    stsd.write_u32::<BigEndian>(0).unwrap();
+    stsd.write_u32::<BigEndian>(1).unwrap();
+    stsd.write_u32::<BigEndian>(16).unwrap();
+    stsd.write_four_cc(FourCC::from_str("data")).unwrap();
+    stsd.write_all(&[0; 6]).unwrap();
+    stsd.write_u16::<BigEndian>(1).unwrap();
+    write_container(&mut stbl, "stsd", &stsd);
+    stbl.write_atom(time_to_sample).unwrap();
+    stbl.write_atom(SampleToChunkData {
+        entries: vec![SampleToChunkDataEntry {
+            first_chunk: 1,
+            samples_per_chunk: SAMPLES_PER_CHUNK,
+            sample_description_id: 1,
+        }],
+        ..Default::default()
+    })
+    .unwrap();
+    stbl.write_atom(SampleSizeData {
+        sample_count: SAMPLE_COUNT,
+        sample_sizes: (0..SAMPLE_COUNT).map(sample_size).collect(),
+        ..Default::default()
+    })
+    .unwrap();
+    stbl.write_atom(ChunkOffset64Data {
+        offsets: chunk_offsets,
+        ..Default::default()
+    })
+    .unwrap();
+
+    let mut minf = vec![];
+    write_container(&mut minf, "gmhd", &[]);
+    write_container(&mut minf, "stbl", &stbl);
+
+    let mut hdlr = vec![];
+    hdlr.write_u32::<BigEndian>(0).unwrap();
+    hdlr.write_four_cc(FourCC::from_str("mhlr")).unwrap();
+    hdlr.write_four_cc(FourCC::from_str("data")).unwrap();
+    hdlr.write_all(&[0; 12]).unwrap();
+
+    let mut mdia = vec![];
+    mdia.write_atom(MediaHeaderData {
+        version: 0,
+        flags: [0; 3],
+        creation_time: 0,
+        modification_time: 0,
+        time_scale: TIME_SCALE,
+        duration,
+        language: 0,
+        quality: 0,
+    })
+    .unwrap();
+    write_container(&mut mdia, "hdlr", &hdlr);
+    write_container(&mut mdia, "minf", &minf);
+
+    let mut trak = vec![];
+    trak.write_atom(TrackHeaderData {
+        version: 0,
+        flags: [0, 0, 3],
+        creation_time: 0,
+        modification_time: 0,
+        id: 1,
+        reserved: 0,
+        duration,
+        reserved2: [0; 8],
+        layer: 0,
+        alternate_group: 0,
+        volume: 0.0.into(),
+        reserved3: 0,
+        matrix_structure: [0x10000, 0, 0, 0, 0x10000, 0, 0, 0, 0x4000_0000],
+        width: 0.0.into(),
+        height: 0.0.into(),
+    })
+    .unwrap();
+    write_container(&mut trak, "mdia", &mdia);
+
+    let mut moov = vec![];
+    moov.write_atom(MovieHeaderData {
+        version: 0,
+        flags: [0; 3],
+        creation_time: 0,
+        modification_time: 0,
+        time_scale: TIME_SCALE,
+        duration,
+        preferred_rate: 1.0.into(),
+        preferred_volume: 1.0.into(),
+        reserved: [0; 10],
+        matrix_structure: [0x10000, 0, 0, 0, 0x10000, 0, 0, 0, 0x4000_0000],
+        preview_time: 0,
+        preview_duration: 0,
+        poster_time: 0,
+        selection_time: 0,
+        selection_duration: 0,
+        current_time: 0,
+        next_track_id: 2,
+    })
+    .unwrap();
+    write_container(&mut moov, "trak", &trak);
+    write_container(&mut f, "moov", &moov);
+}
+
+/// Returns the start times of the clips, spread over the whole movie.
+fn clip_starts(duration: u64) -> Vec<u64> {
+    (0..CLIP_COUNT)
+        .map(|i| (i * 7 % CLIP_COUNT) * (duration - CLIP_DURATION) / CLIP_COUNT)
+        .collect()
+}
+
+/// Truncates the output file so that it can be reused.
+fn reset(out: &mut std::fs::File) -> &mut std::fs::File {
+    out.set_len(0).unwrap();
+    out.seek(SeekFrom::Start(0)).unwrap();
+    out
+}
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let dir = tempfile::TempDir::new().unwrap();
+    let source_path = dir.path().join("source.mov");
+    write_source(&source_path);
+    let duration = File::open(&source_path).unwrap().movie_data().unwrap().header.duration as u64;
+    let clip_starts = clip_starts(duration);
+    let mut out = std::fs::File::create(dir.path().join("out.mov")).unwrap();
+
+    let mut group = c.benchmark_group("trim");
+    group.sample_size(10);
+    group.throughput(Throughput::Elements(CLIP_COUNT));
+    // Reopening the file for every clip pays for reading and parsing the movie and building the
+    // sample index each time, which is about what every trim cost before they were cached.
+    group.bench_function("reopen_per_clip", |b| {
+        b.iter(|| {
+            for &start in &clip_starts {
+                let mut f = File::open(&source_path).unwrap();
+                f.trim(reset(&mut out), TIME_SCALE, start, CLIP_DURATION).unwrap();
+            }
+        })
+    });
+    group.bench_function("read", |b| {
+        let mut f = File::open(&source_path).unwrap();
+        b.iter(|| {
+            for &start in &clip_starts {
+                f.trim(reset(&mut out), TIME_SCALE, start, CLIP_DURATION).unwrap();
+            }
+        })
+    });
+    group.bench_function("mmap", |b| {
+        // The source file isn't modified while it's mapped.
+        let mut f = unsafe { File::open_mmap(&source_path) }.unwrap();
+        b.iter(|| {
+            for &start in &clip_starts {
+                f.trim(reset(&mut out), TIME_SCALE, start, CLIP_DURATION).unwrap();
+            }
+        })
+    });
+    group.bench_function("mmap_to_file", |b| {
+        // The source file isn't modified while it's mapped.
+        let mut f = unsafe { File::open_mmap(&source_path) }.unwrap();
+        b.iter(|| {
+            for &start in &clip_starts {
+                f.trim_to_file(reset(&mut out), TIME_SCALE, start, CLIP_DURATION).unwrap();
+            }
+        })
+    });
+    group.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
@@ -496,7 +496,7 @@ impl AtomData for SampleToChunkData {
     const TYPE: FourCC = FourCC::STSC;
 }
 
-#[derive(Clone, Debug)]
+#[derive(Clone, Debug, PartialEq, Eq)]
 pub struct SampleChunkInfo {
     // The zero-based chunk number.
     pub number: u32,
@@ -1,8 +1,12 @@
 use std::io::{copy, Cursor, Read, Seek, SeekFrom, Write};
 use std::path::Path;
+use std::sync::Arc;
 
 use super::atom::{AtomReader, AtomSize, AtomWriteExt, FourCC};
 use super::error::{Error, Result};
+#[cfg(unix)]
+use super::mmap::Mmap;
+use super::sample_index::SampleIndex;
 use super::{
     data,
     data::{AtomData, MovieData, ReadData},
@@ -13,10 +17,24 @@ use byteorder::{BigEndian, ReadBytesExt, WriteBytesExt};
 
 pub struct File {
     f: std::fs::File,
-    movie_data: Option<MovieData>,
+    #[cfg(unix)]
+    map: Option<Mmap>,
+    // The contents of the moov atom and the offset of the first byte after it.
+    moov_data: Option<(Arc<[u8]>, u64)>,
+    movie_data: Option<Arc<MovieData>>,
+    sample_indices: Vec<Option<Arc<SampleIndex>>>,
     movie_fragments: Option<Vec<(u64, MovieFragment)>>,
 }
 
+// The ways sample data can be copied into a file, from fastest to slowest. On Linux, each is
+// tried in order until one is supported by the files and kernel.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+enum FileCopy {
+    CopyFileRange,
+    Sendfile,
+    ReadWrite,
+}
+
 enum Data {
     SourceFile(u64, usize),
     Vec(Vec<u8>),
@@ -35,14 +53,57 @@ impl File {
     pub fn open<P: AsRef<Path>>(path: P) -> Result<File> {
         Ok(File {
             f: std::fs::File::open(path)?,
+            #[cfg(unix)]
+            map: None,
+            moov_data: None,
             movie_data: None,
+            sample_indices: vec![],
             movie_fragments: None,
         })
     }
 
-    fn read_moov_data(&mut self) -> Result<Vec<u8>> {
-        self.f.seek(SeekFrom::Start(0))?;
-        let atom = match AtomReader::new(&mut self.f).find(|a| match a {
+    /// Opens the file and maps it into memory. Atoms and sample data are then read directly from
+    /// the mapping instead of with seeks and reads, which is considerably faster when trimming many
+    /// clips out of one large file.
+    ///
+    /// # Safety
+    ///
+    /// The file must not be modified or truncated, by this or any other process, while the
+    /// returned File exists. Changes to the file may be visible through the mapping, which is
+    /// undefined behavior, and accessing pages past the end of a truncated file raises SIGBUS.
+    #[cfg(unix)]
+    pub unsafe fn open_mmap<P: AsRef<Path>>(path: P) -> Result<File> {
+        let mut ret = Self::open(path)?;
+        ret.map = Some(Mmap::map(&ret.f)?);
+        Ok(ret)
+    }
+
+    #[cfg(unix)]
+    fn mapped(&self) -> Option<&[u8]> {
+        self.map.as_deref()
+    }
+
+    #[cfg(not(unix))]
+    fn mapped(&self) -> Option<&[u8]> {
+        None
+    }
+
+    fn read_moov_data(&mut self) -> Result<(Arc<[u8]>, u64)> {
+        if let Some((moov, end)) = &self.moov_data {
+            return Ok((moov.clone(), *end));
+        }
+        let (moov, end) = match self.mapped() {
+            Some(map) => Self::read_moov_data_from(Cursor::new(map))?,
+            None => Self::read_moov_data_from(&self.f)?,
+        };
+        let moov: Arc<[u8]> = moov.into();
+        self.moov_data = Some((moov.clone(), end));
+        Ok((moov, end))
+    }
+
+    fn read_moov_data_from<R: Read + Seek>(mut r: R) -> Result<(Vec<u8>, u64)> {
+        r.seek(SeekFrom::Start(0))?;
+        let atom = match AtomReader::new(&mut r).find(|a| match a {
             Ok(a) => a.typ == MovieData::TYPE,
             Err(_) => true,
         }) {
@@ -52,28 +113,62 @@ impl File {
         };
         // minimize reads by pre-loading the entire atom
         let mut buf = Vec::new();
-        atom.data(&mut self.f).read_to_end(&mut buf)?;
-        Ok(buf)
+        atom.data(&mut r).read_to_end(&mut buf)?;
+        Ok((buf, (atom.offset + atom.size.as_usize()) as u64))
     }
 
-    pub fn get_movie_data(&mut self) -> Result<MovieData> {
-        match &self.movie_data {
-            Some(v) => Ok(v.clone()),
-            None => {
-                let buf = self.read_moov_data()?;
-                let data = MovieData::read(Cursor::new(buf.as_slice()))?;
-                self.movie_data = Some(data.clone());
-                Ok(data)
-            }
+    fn load_movie_data(&mut self) -> Result<Arc<MovieData>> {
+        if let Some(v) = &self.movie_data {
+            return Ok(v.clone());
         }
+        let (moov, _) = self.read_moov_data()?;
+        let data = Arc::new(MovieData::read(Cursor::new(&moov[..]))?);
+        self.sample_indices = vec![None; data.tracks.len()];
+        self.movie_data = Some(data.clone());
+        Ok(data)
     }
 
-    fn get_moof_data(&mut self) -> Result<Vec<(u64, MovieFragment)>> {
+    pub fn get_movie_data(&mut self) -> Result<MovieData> {
+        Ok(self.load_movie_data()?.as_ref().clone())
+    }
+
+    // Like get_movie_data, but borrows the data instead of cloning it.
+    pub fn movie_data(&mut self) -> Result<&MovieData> {
+        self.load_movie_data()?;
+        Ok(self.movie_data.as_deref().expect("the movie data was just loaded"))
+    }
+
+    // Returns an index for the sample table of the given zero-based track, building it on first
+    // use. Tracks without sample tables get an empty index.
+    pub fn sample_index(&mut self, track: usize) -> Result<Arc<SampleIndex>> {
+        let movie_data = self.load_movie_data()?;
+        let index = self.sample_indices.get_mut(track).ok_or(Error::Other("track not found"))?;
+        Ok(index
+            .get_or_insert_with(|| {
+                Arc::new(
+                    movie_data.tracks[track]
+                        .media
+                        .information
+                        .as_ref()
+                        .and_then(|minf| match minf {
+                            data::MediaInformationData::Sound(minf) => minf.sample_table.as_ref().map(SampleIndex::new),
+                            data::MediaInformationData::Timecode(minf) => minf.sample_table.as_ref().map(SampleIndex::new),
+                            data::MediaInformationData::Video(minf) => minf.sample_table.as_ref().map(SampleIndex::new),
+                            data::MediaInformationData::Base(minf) => minf.sample_table.as_ref().map(SampleIndex::new),
+                        })
+                        .unwrap_or_default(),
+                )
+            })
+            .clone())
+    }
+
+    fn read_movie_fragments<R: Read + Seek>(mut r: R, offset: u64) -> Result<Vec<(u64, MovieFragment)>> {
+        r.seek(SeekFrom::Start(offset))?;
         let mut fragments = vec![];
         loop {
-            let start_position = self.f.stream_position()?;
+            let start_position = r.stream_position()?;
 
-            let atom = match AtomReader::new(&mut self.f).find(|a| match a {
+            let atom = match AtomReader::new(&mut r).find(|a| match a {
                 Ok(a) => a.typ == MovieFragment::TYPE,
                 Err(_) => true,
             }) {
@@ -82,33 +177,124 @@ impl File {
                 None => return Ok(fragments),
             };
             let mut buf = Vec::new();
-            atom.data(&mut self.f).read_to_end(&mut buf)?;
+            atom.data(&mut r).read_to_end(&mut buf)?;
 
             fragments.push((start_position, MovieFragment::read(Cursor::new(buf.as_slice()))?));
         }
     }
 
     pub fn get_movie_fragments(&mut self) -> Result<Vec<(u64, MovieFragment)>> {
-        if self.movie_data.is_none() {
-            self.get_movie_data()?;
+        Ok(self.movie_fragments()?.to_vec())
+    }
+
+    // Like get_movie_fragments, but borrows the fragments instead of cloning them.
+    pub fn movie_fragments(&mut self) -> Result<&[(u64, MovieFragment)]> {
+        if self.movie_fragments.is_none() {
+            self.load_movie_data()?;
+            let (_, moov_end) = self.read_moov_data()?;
+            let movie_fragments = match self.mapped() {
+                Some(map) => Self::read_movie_fragments(Cursor::new(map), moov_end)?,
+                None => Self::read_movie_fragments(&self.f, moov_end)?,
+            };
+            self.movie_fragments = Some(movie_fragments);
         }
-        match &self.movie_fragments {
-            Some(v) => Ok(v.clone()),
+        Ok(self.movie_fragments.as_deref().unwrap_or_default())
+    }
+
+    // Reads the given range of the source file.
+    fn read_source_range(&self, offset: u64, size: usize) -> Result<Vec<u8>> {
+        match self.mapped() {
+            Some(map) => map
+                .get(offset as usize..offset as usize + size)
+                .map(|data| data.to_vec())
+                .ok_or(Error::MalformedFile("sample data out of bounds")),
             None => {
-                let movie_fragments = self.get_moof_data()?;
-                self.movie_fragments = Some(movie_fragments.clone());
-                Ok(movie_fragments)
+                let mut f = &self.f;
+                f.seek(SeekFrom::Start(offset))?;
+                let mut buf = vec![0; size];
+                f.read_exact(&mut buf)?;
+                Ok(buf)
             }
         }
     }
 
-    pub fn trim_frames<W: Write>(&mut self, w: W, start_frame: u64, frame_count: u64) -> Result<()> {
-        let movie_data = self.get_movie_data()?;
+    // Copies the given range of the source file. Like io::copy, this stops early at the end of
+    // the file.
+    fn copy_source_range<W: Write>(&self, w: &mut W, offset: u64, size: u64) -> Result<()> {
+        match self.mapped() {
+            Some(map) => {
+                let start = (offset as usize).min(map.len());
+                let end = ((offset + size) as usize).min(map.len());
+                w.write_all(&map[start..end])?;
+            }
+            None => {
+                let mut f = &self.f;
+                f.seek(SeekFrom::Start(offset))?;
+                copy(&mut f.take(size), w)?;
+            }
+        }
+        Ok(())
+    }
+
+    // Copies the given range of the source file into another file. On Linux, this is done within
+    // the kernel via copy_file_range or sendfile when possible.
+    // The given method is tried first.
+    #[cfg(target_os = "linux")]
+    fn copy_source_range_to_file(&self, dest: &mut std::fs::File, mut offset: u64, mut size: u64, mut method: FileCopy) -> Result<()> {
+        use std::os::unix::io::AsRawFd;
+
+        while size > 0 {
+            let mut off_in = offset as libc::off64_t;
+            let n = match method {
+                FileCopy::CopyFileRange => unsafe {
+                    libc::copy_file_range(self.f.as_raw_fd(), &mut off_in, dest.as_raw_fd(), std::ptr::null_mut(), size as usize, 0)
+                },
+                FileCopy::Sendfile => unsafe { libc::sendfile64(dest.as_raw_fd(), self.f.as_raw_fd(), &mut off_in, size as usize) },
+                FileCopy::ReadWrite => return self.copy_source_range(dest, offset, size),
+            };
+            if n < 0 {
+                let err = std::io::Error::last_os_error();
+                match err.raw_os_error() {
+                    Some(libc::EINTR) => continue,
+                    // copy_file_range doesn't support destinations opened for appending
+                    Some(libc::EBADF) if method == FileCopy::CopyFileRange => {
+                        method = FileCopy::Sendfile;
+                        continue;
+                    }
+                    // these indicate that the files or kernel don't support the syscall
+                    Some(libc::ENOSYS) | Some(libc::EXDEV) | Some(libc::EINVAL) | Some(libc::EOPNOTSUPP) | Some(libc::EPERM) => {
+                        method = match method {
+                            FileCopy::CopyFileRange => FileCopy::Sendfile,
+                            _ => FileCopy::ReadWrite,
+                        };
+                        continue;
+                    }
+                    _ => return Err(err.into()),
+                }
+            } else if n == 0 {
+                // the end of the source file
+                break;
+            }
+            offset += n as u64;
+            size -= n as u64;
+        }
+        Ok(())
+    }
+
+    #[cfg(not(target_os = "linux"))]
+    fn copy_source_range_to_file(&self, dest: &mut std::fs::File, offset: u64, size: u64, _method: FileCopy) -> Result<()> {
+        self.copy_source_range(dest, offset, size)
+    }
+
+    // Returns the time scale, start time, and duration of the given range of video frames.
+    fn frame_range_time(&mut self, start_frame: u64, frame_count: u64) -> Result<(u32, u64, u64)> {
+        let movie_data = self.load_movie_data()?;
 
-        let video_track = movie_data
+        let (video_track_index, video_track) = movie_data
             .tracks
             .iter()
-            .find(|t| matches!(t.media.information.as_ref(), Some(data::MediaInformationData::Video(_))))
+            .enumerate()
+            .find(|(_, t)| matches!(t.media.information.as_ref(), Some(data::MediaInformationData::Video(_))))
             .ok_or(Error::Other("no video track"))?;
 
         let video_minf = match &video_track.media.information {
@@ -118,22 +304,35 @@ impl File {
 
         let time_scale = video_track.media.header.time_scale;
         let sample_table = video_minf.sample_table.as_ref().ok_or(Error::Other("no sample table for video"))?;
+        let index = self.sample_index(video_track_index)?;
         let start_time = sample_table
             .time_to_sample
             .as_ref()
-            .and_then(|stts| stts.sample_time(start_frame))
+            .and_then(|_| index.sample_time(start_frame))
             .ok_or(Error::Other("start frame not found"))?;
         let end_time = sample_table
             .time_to_sample
             .as_ref()
-            .and_then(|stts| stts.sample_time(start_frame + frame_count))
+            .and_then(|_| index.sample_time(start_frame + frame_count))
             .ok_or(Error::Other("end frame not found"))?;
 
-        self.trim(w, time_scale, start_time, end_time - start_time)
+        Ok((time_scale, start_time, end_time - start_time))
+    }
+
+    pub fn trim_frames<W: Write>(&mut self, w: W, start_frame: u64, frame_count: u64) -> Result<()> {
+        let (time_scale, start, duration) = self.frame_range_time(start_frame, frame_count)?;
+        self.trim(w, time_scale, start, duration)
+    }
+
+    // Like trim_frames, but copies the sample data using trim_to_file.
+    pub fn trim_frames_to_file(&mut self, f: &mut std::fs::File, start_frame: u64, frame_count: u64) -> Result<()> {
+        let (time_scale, start, duration) = self.frame_range_time(start_frame, frame_count)?;
+        self.trim_to_file(f, time_scale, start, duration)
     }
 
     fn trim_sample_table<M: Clone + data::MediaType>(
         source: &data::SampleTableData<M>,
+        index: &SampleIndex,
         start_sample: u64,
         sample_count: u64,
         data_offset: &mut u64,
@@ -156,20 +355,6 @@ impl File {
             let total_chunks = stsc.sample_chunk(sample_count - 1) + 1;
             out.offsets.resize(total_chunks as usize, 0);
 
-            let mut sample_chunk_info_hint = None;
-            let source_sample_offset = |n: u64, hint: &mut Option<data::SampleChunkInfo>| -> Option<u64> {
-                let chunk_info = source.sample_chunk_info(n, hint.as_ref())?;
-                let ret = source.sample_offset(n, &chunk_info);
-                *hint = Some(chunk_info);
-                ret
-            };
-            let source_sample_size = |n: u64, hint: &mut Option<data::SampleChunkInfo>| -> Option<u32> {
-                let chunk_info = source.sample_chunk_info(n, hint.as_ref())?;
-                let ret = source.sample_size(n, &chunk_info);
-                *hint = Some(chunk_info);
-                ret
-            };
-
             let mut chunk_start_sample = 0;
             for i in 0..stsc.entries.len() {
                 let e = &stsc.entries[i];
@@ -183,9 +368,8 @@ impl File {
 
                     let chunk_end_sample = chunk_start_sample + e.samples_per_chunk as u64;
 
-                    let source_start_offset = source_sample_offset(start_sample + chunk_start_sample, &mut sample_chunk_info_hint)?;
-                    let last_sample_size = source_sample_size(start_sample + chunk_end_sample - 1, &mut sample_chunk_info_hint)?;
-                    let source_end_offset = source_sample_offset(start_sample + chunk_end_sample - 1, &mut sample_chunk_info_hint)? + last_sample_size as u64;
+                    let source_start_offset = index.sample_offset(start_sample + chunk_start_sample)?;
+                    let source_end_offset = index.sample_range(start_sample + chunk_end_sample - 1)?.end;
 
                     let chunk_size = source_end_offset - source_start_offset;
                     mdat.push(Data::SourceFile(source_start_offset, chunk_size as _));
@@ -200,8 +384,62 @@ impl File {
         (dest, mdat)
     }
 
-    #[allow(clippy::cognitive_complexity)]
     pub fn trim<W: Write>(&mut self, mut w: W, time_scale: u32, start: u64, duration: u64) -> Result<()> {
+        let (moov, mdat) = self.trimmed_atoms(time_scale, start, duration)?;
+        Self::write_trimmed(&mut w, moov, mdat, |w, offset, size| self.copy_source_range(w, offset, size))
+    }
+
+    // Like trim, but writes to a file. On Linux, the sample data is copied within the kernel
+    // instead of through user space when possible.
+    pub fn trim_to_file(&mut self, f: &mut std::fs::File, time_scale: u32, start: u64, duration: u64) -> Result<()> {
+        self.trim_to_file_with(f, time_scale, start, duration, FileCopy::CopyFileRange)
+    }
+
+    fn trim_to_file_with(&mut self, f: &mut std::fs::File, time_scale: u32, start: u64, duration: u64, method: FileCopy) -> Result<()> {
+        let (moov, mdat) = self.trimmed_atoms(time_scale, start, duration)?;
+        Self::write_trimmed(f, moov, mdat, |f, offset, size| self.copy_source_range_to_file(f, offset, size, method))
+    }
+
+    fn write_trimmed<W: Write, F: FnMut(&mut W, u64, u64) -> Result<()>>(w: &mut W, moov: Vec<u8>, mdat: Vec<Data>, mut copy_source_range: F) -> Result<()> {
+        let mdat_data_size = mdat.iter().fold(0_u64, |acc, data| acc + data.len() as u64);
+        w.write_atom_header(FourCC::from_str("mdat"), AtomSize::ExtendedSize(mdat_data_size))?;
+
+        // contiguous ranges of the source file are copied together
+        let mut source_range: Option<(u64, u64)> = None;
+        for data in mdat {
+            match data {
+                Data::SourceFile(offset, size) => match &mut source_range {
+                    Some((range_offset, range_size)) if *range_offset + *range_size == offset => *range_size += size as u64,
+                    _ => {
+                        if let Some((range_offset, range_size)) = source_range.take() {
+                            copy_source_range(w, range_offset, range_size)?;
+                        }
+                        source_range = Some((offset, size as u64));
+                    }
+                },
+                Data::Vec(buf) => {
+                    if let Some((range_offset, range_size)) = source_range.take() {
+                        copy_source_range(w, range_offset, range_size)?;
+                    }
+                    w.write_all(&buf)?;
+                }
+            }
+        }
+        if let Some((range_offset, range_size)) = source_range {
+            copy_source_range(w, range_offset, range_size)?;
+        }
+
+        w.write_atom_header(MovieData::TYPE, moov.len())?;
+        w.write_all(&moov)?;
+
+        Ok(())
+    }
+
+    // Builds the moov atom and the mdat contents for a trimmed copy of the file. The sample tables
+    // come from the cached movie data and are searched via the sample indices, so repeated trims
+    // only pay for the samples they keep.
+    #[allow(clippy::cognitive_complexity)]
+    fn trimmed_atoms(&mut self, time_scale: u32, start: u64, duration: u64) -> Result<(Vec<u8>, Vec<Data>)> {
         let mut moov: Vec<u8> = Vec::new();
         let mut mdat: Vec<Data> = Vec::new();
 
@@ -209,8 +447,10 @@ impl File {
         let start_time_secs = (start as f64) / (time_scale as f64);
         let end_time_secs = ((start + duration) as f64) / (time_scale as f64);
 
-        let moov_data = self.read_moov_data()?;
-        let mut r = Cursor::new(moov_data.as_slice());
+        let (moov_data, _) = self.read_moov_data()?;
+        let movie_data = self.load_movie_data()?;
+        let mut track_index = 0;
+        let mut r = Cursor::new(&moov_data[..]);
         for atom in AtomReader::new(&mut r).collect::<Vec<_>>().drain(..) {
             let atom = atom?;
             match atom.typ {
@@ -228,7 +468,9 @@ impl File {
                     moov.write_atom(data)?;
                 }
                 data::TrackData::TYPE => {
-                    let track = data::TrackData::read(atom.data(r.clone()))?;
+                    let track = movie_data.tracks.get(track_index).ok_or(Error::MalformedFile("unexpected track"))?;
+                    let index = self.sample_index(track_index)?;
+                    track_index += 1;
 
                     let mut start_time = (start_time_secs * track.media.header.time_scale as f64).round() as u64;
                     let mut end_time = (end_time_secs * track.media.header.time_scale as f64).round() as u64;
@@ -251,37 +493,8 @@ impl File {
                         }
                     }
 
-                    let source_time_to_sample = track.media.information.as_ref().and_then(|minf| match minf {
-                        data::MediaInformationData::Sound(minf) => minf.sample_table.as_ref().and_then(|v| v.time_to_sample.as_ref()),
-                        data::MediaInformationData::Timecode(minf) => minf.sample_table.as_ref().and_then(|v| v.time_to_sample.as_ref()),
-                        data::MediaInformationData::Video(minf) => minf.sample_table.as_ref().and_then(|v| v.time_to_sample.as_ref()),
-                        data::MediaInformationData::Base(minf) => minf.sample_table.as_ref().and_then(|v| v.time_to_sample.as_ref()),
-                    });
-
-                    let mut start_sample = None;
-                    let mut end_sample = None;
-                    let mut start_sample_time = 0;
-                    if let Some(stts) = source_time_to_sample {
-                        let mut t = 0;
-                        let mut n = 0;
-                        for entry in stts.entries.iter() {
-                            if entry.sample_duration > 0 {
-                                let next_entry_time: u64 = t + (entry.sample_duration as u64) * (entry.sample_count as u64);
-                                if next_entry_time > start_time && start_sample.is_none() {
-                                    let relative_start_sample = (start_time - t) / (entry.sample_duration as u64);
-                                    start_sample = Some(n + relative_start_sample);
-                                    start_sample_time = t + relative_start_sample * entry.sample_duration as u64;
-                                }
-                                if next_entry_time >= end_time && end_sample.is_none() {
-                                    end_sample = Some(n + (end_time - t + entry.sample_duration as u64 - 1) / (entry.sample_duration as u64));
-                                }
-                                t = next_entry_time;
-                            }
-                            n += entry.sample_count as u64;
-                        }
-                    }
-                    let start_sample = start_sample.unwrap_or(0);
-                    let end_sample = end_sample.unwrap_or(0);
+                    let (start_sample, mut start_sample_time) = index.sample_at_time(start_time).unwrap_or((0, 0));
+                    let end_sample = index.samples_before_time(end_time).unwrap_or(0);
                     let sample_count = end_sample - start_sample;
 
                     let (time_to_sample, sample_to_chunk, sample_size, chunk_offset, mut mdat_additions) = track
@@ -291,15 +504,15 @@ impl File {
                         .and_then(|minf| -> Option<Result<_>> {
                             match minf {
                                 data::MediaInformationData::Sound(minf) => minf.sample_table.as_ref().map(|v| {
-                                    let (table, mdat) = Self::trim_sample_table(v, start_sample, sample_count, &mut data_offset);
+                                    let (table, mdat) = Self::trim_sample_table(v, &index, start_sample, sample_count, &mut data_offset);
                                     Ok((table.time_to_sample, table.sample_to_chunk, table.sample_size, table.chunk_offset_64, mdat))
                                 }),
                                 data::MediaInformationData::Video(minf) => minf.sample_table.as_ref().map(|v| {
-                                    let (table, mdat) = Self::trim_sample_table(v, start_sample, sample_count, &mut data_offset);
+                                    let (table, mdat) = Self::trim_sample_table(v, &index, start_sample, sample_count, &mut data_offset);
                                     Ok((table.time_to_sample, table.sample_to_chunk, table.sample_size, table.chunk_offset_64, mdat))
                                 }),
                                 data::MediaInformationData::Timecode(minf) => minf.sample_table.as_ref().map(|v| {
-                                    let (mut table, mut mdat) = Self::trim_sample_table(v, start_sample, sample_count, &mut data_offset);
+                                    let (mut table, mut mdat) = Self::trim_sample_table(v, &index, start_sample, sample_count, &mut data_offset);
 
                                     if sample_count > 0 && !mdat.is_empty() && start_sample_time < start_time {
                                         // modify the first timecode sample so we don't have to use an edit
@@ -326,12 +539,7 @@ impl File {
                                         }
 
                                         let mut data = match &mdat[0] {
-                                            Data::SourceFile(source_offset, source_size) => {
-                                                self.f.seek(SeekFrom::Start(*source_offset))?;
-                                                let mut buf = vec![0; *source_size];
-                                                self.f.read_exact(&mut buf)?;
-                                                buf
-                                            }
+                                            Data::SourceFile(source_offset, source_size) => self.read_source_range(*source_offset, *source_size)?,
                                             Data::Vec(buf) => buf.clone(),
                                         };
 
@@ -355,7 +563,7 @@ impl File {
                                     Ok((table.time_to_sample, table.sample_to_chunk, table.sample_size, table.chunk_offset_64, mdat))
                                 }),
                                 data::MediaInformationData::Base(minf) => minf.sample_table.as_ref().map(|v| {
-                                    let (table, mdat) = Self::trim_sample_table(v, start_sample, sample_count, &mut data_offset);
+                                    let (table, mdat) = Self::trim_sample_table(v, &index, start_sample, sample_count, &mut data_offset);
                                     Ok((table.time_to_sample, table.sample_to_chunk, table.sample_size, table.chunk_offset_64, mdat))
                                 }),
                             }
@@ -472,24 +680,7 @@ impl File {
             }
         }
 
-        let mdat_data_size = mdat.iter().fold(0_u64, |acc, data| acc + data.len() as u64);
-        w.write_atom_header(FourCC::from_str("mdat"), AtomSize::ExtendedSize(mdat_data_size))?;
-        for mut data in mdat.drain(..) {
-            match &mut data {
-                Data::SourceFile(offset, size) => {
-                    self.f.seek(SeekFrom::Start(*offset))?;
-                    copy(&mut (&self.f).take(*size as u64), &mut w)?;
-                }
-                Data::Vec(buf) => {
-                    copy(&mut buf.as_slice(), &mut w)?;
-                }
-            }
-        }
-
-        w.write_atom_header(MovieData::TYPE, moov.len())?;
-        copy(&mut moov.as_slice(), &mut w)?;
-
-        Ok(())
+        Ok((moov, mdat))
     }
 }
 
@@ -813,4 +1004,102 @@ mod tests {
             }
         );
     }
+
+    // The mp4 test files have edit lists that trim doesn't support.
+    const TRIM_TEST_FILE: &str = "src/testdata/braw_trimmed.braw";
+
+    // Runs the trim against a temporary file and returns what it wrote.
+    fn trim_to_temp_file<F: FnOnce(&mut std::fs::File) -> Result<()>>(trim: F) -> Vec<u8> {
+        let mut out = tempfile::tempfile().unwrap();
+        trim(&mut out).unwrap();
+        out.seek(SeekFrom::Start(0)).unwrap();
+        let mut buf = Vec::new();
+        out.read_to_end(&mut buf).unwrap();
+        buf
+    }
+
+    // Checks that every way of trimming the file writes exactly what trim and trim_frames do.
+    fn check_trim_variants(f: &mut File) {
+        let header = &f.movie_data().unwrap().header;
+        let (time_scale, start, duration) = (header.time_scale, header.duration as u64 / 4, header.duration as u64 / 2);
+
+        let mut expected = Vec::new();
+        f.trim(&mut expected, time_scale, start, duration).unwrap();
+        assert!(!expected.is_empty());
+        assert_eq!(trim_to_temp_file(|out| f.trim_to_file(out, time_scale, start, duration)), expected);
+        for &method in &[FileCopy::CopyFileRange, FileCopy::Sendfile, FileCopy::ReadWrite] {
+            let actual = trim_to_temp_file(|out| f.trim_to_file_with(out, time_scale, start, duration, method));
+            assert_eq!(actual, expected, "{:?}", method);
+        }
+
+        let mut expected = Vec::new();
+        f.trim_frames(&mut expected, 1, 1).unwrap();
+        assert_eq!(trim_to_temp_file(|out| f.trim_frames_to_file(out, 1, 1)), expected);
+    }
+
+    #[test]
+    fn test_file_trim_variants() {
+        check_trim_variants(&mut File::open(TRIM_TEST_FILE).unwrap());
+    }
+
+    #[cfg(unix)]
+    #[test]
+    fn test_file_trim_variants_mmap() {
+        let mut expected = Vec::new();
+        let mut f = File::open(TRIM_TEST_FILE).unwrap();
+        let header = &f.movie_data().unwrap().header;
+        let (time_scale, start, duration) = (header.time_scale, header.duration as u64 / 4, header.duration as u64 / 2);
+        f.trim(&mut expected, time_scale, start, duration).unwrap();
+
+        // The test file is never modified.
+        let mut f = unsafe { File::open_mmap(TRIM_TEST_FILE) }.unwrap();
+        let mut actual = Vec::new();
+        f.trim(&mut actual, time_scale, start, duration).unwrap();
+        assert_eq!(actual, expected);
+        check_trim_variants(&mut f);
+    }
+
+    // Exercises the fallbacks with destinations that the faster methods reject, rather than by
+    // choosing the method to start with.
+    #[cfg(target_os = "linux")]
+    #[test]
+    fn test_file_trim_to_file_fallback() {
+        use std::os::unix::io::FromRawFd;
+
+        let mut f = File::open(TRIM_TEST_FILE).unwrap();
+        let mut expected = Vec::new();
+        f.trim_frames(&mut expected, 1, 1).unwrap();
+
+        // copy_file_range only supports regular files, so writing to a pipe falls back to sendfile.
+        let mut fds = [0; 2];
+        assert_eq!(unsafe { libc::pipe(fds.as_mut_ptr()) }, 0);
+        let (mut reader, mut writer) = unsafe { (std::fs::File::from_raw_fd(fds[0]), std::fs::File::from_raw_fd(fds[1])) };
+        let reader = std::thread::spawn(move || {
+            let mut buf = Vec::new();
+            reader.read_to_end(&mut buf).unwrap();
+            buf
+        });
+        f.trim_frames_to_file(&mut writer, 1, 1).unwrap();
+        drop(writer);
+        assert_eq!(reader.join().unwrap(), expected);
+
+        // Neither copy_file_range nor sendfile support files opened for appending, so this falls
+        // back to reads and writes.
+        let dir = tempfile::TempDir::new().unwrap();
+        let path = dir.path().join("tmp.mov");
+        let mut out = std::fs::OpenOptions::new().create(true).append(true).open(&path).unwrap();
+        f.trim_frames_to_file(&mut out, 1, 1).unwrap();
+        drop(out);
+        assert_eq!(std::fs::read(&path).unwrap(), expected);
+
+        let header = &f.movie_data().unwrap().header;
+        let (time_scale, start, duration) = (header.time_scale, header.duration as u64 / 4, header.duration as u64 / 2);
+        let mut expected = Vec::new();
+        f.trim(&mut expected, time_scale, start, duration).unwrap();
+        let path = dir.path().join("tmp2.mov");
+        let mut out = std::fs::OpenOptions::new().create(true).append(true).open(&path).unwrap();
+        f.trim_to_file(&mut out, time_scale, start, duration).unwrap();
+        drop(out);
+        assert_eq!(std::fs::read(&path).unwrap(), expected);
+    }
 }
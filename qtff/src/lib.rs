@@ -8,10 +8,14 @@ pub mod data;
 pub mod deserializer;
 pub mod error;
 pub mod file;
+#[cfg(unix)]
+mod mmap;
 pub mod moof;
+pub mod sample_index;
 pub mod serializer;
 
 pub use atom::*;
 pub use data::*;
 pub use error::*;
 pub use file::*;
+pub use sample_index::*;
@@ -0,0 +1,291 @@
+use std::ops::Range;
+
+use super::data::{MediaType, SampleChunkInfo, SampleTableData};
+
+#[derive(Clone, Debug)]
+struct TimeToSampleRun {
+    first_sample: u64,
+    sample_count: u64,
+    start_time: u64,
+    sample_duration: u64,
+}
+
+impl TimeToSampleRun {
+    fn end_time(&self) -> u64 {
+        self.start_time + self.sample_count * self.sample_duration
+    }
+}
+
+#[derive(Clone, Debug)]
+struct SampleToChunkRun {
+    // The one-based chunk number, as in the stsc atom.
+    first_chunk: u32,
+    first_sample: u64,
+    samples_per_chunk: u32,
+    // The zero-based sample description.
+    sample_description: u32,
+}
+
+// SampleIndex answers time, chunk, and byte range queries for a track's sample table in
+// logarithmic time. The sample table atoms are run-length encoded and only support linear
+// lookups, which adds up quickly when trimming many clips out of long files.
+//
+// Lookups agree with the equivalent functions on the sample table data.
+#[derive(Clone, Debug, Default)]
+pub struct SampleIndex {
+    time_to_sample: Vec<TimeToSampleRun>,
+    sample_to_chunk: Vec<SampleToChunkRun>,
+    chunk_offsets: Vec<u64>,
+    has_sample_size: bool,
+    // The constant sample size for each sample description, if any.
+    description_sample_sizes: Vec<Option<u32>>,
+    // Prefix sums of the sample sizes. Element n is the sum of the sizes of samples 0..n.
+    sample_size_offsets: Vec<u64>,
+}
+
+impl SampleIndex {
+    pub fn new<M: MediaType>(table: &SampleTableData<M>) -> Self {
+        let mut ret = Self::default();
+
+        if let Some(stts) = &table.time_to_sample {
+            let mut first_sample = 0;
+            let mut start_time = 0;
+            ret.time_to_sample.reserve(stts.entries.len());
+            for e in &stts.entries {
+                let run = TimeToSampleRun {
+                    first_sample,
+                    sample_count: e.sample_count as _,
+                    start_time,
+                    sample_duration: e.sample_duration as _,
+                };
+                first_sample += run.sample_count;
+                start_time = run.end_time();
+                ret.time_to_sample.push(run);
+            }
+        }
+
+        if let Some(stsc) = &table.sample_to_chunk {
+            let mut first_sample = 0;
+            ret.sample_to_chunk.reserve(stsc.entries.len());
+            for (i, e) in stsc.entries.iter().enumerate() {
+                if i > 0 {
+                    let prev = &stsc.entries[i - 1];
+                    first_sample += ((e.first_chunk - prev.first_chunk) as u64) * (prev.samples_per_chunk as u64);
+                }
+                ret.sample_to_chunk.push(SampleToChunkRun {
+                    first_chunk: e.first_chunk,
+                    first_sample,
+                    samples_per_chunk: e.samples_per_chunk,
+                    sample_description: e.sample_description_id - 1,
+                });
+            }
+        }
+
+        // the 32-bit offsets take precedence, matching SampleTableData::sample_offset
+        if let Some(co) = &table.chunk_offset {
+            ret.chunk_offsets = co.offsets.iter().map(|&n| n as u64).collect();
+        } else if let Some(co) = &table.chunk_offset_64 {
+            ret.chunk_offsets.clone_from(&co.offsets);
+        }
+
+        if let Some(stsz) = &table.sample_size {
+            ret.has_sample_size = true;
+            let constant_sample_size = if stsz.constant_sample_size > 0 {
+                Some(stsz.constant_sample_size)
+            } else {
+                None
+            };
+            if let Some(stsd) = &table.sample_description {
+                ret.description_sample_sizes = stsd.entries.iter().map(|desc| M::constant_sample_size(desc).or(constant_sample_size)).collect();
+            }
+            if constant_sample_size.is_none() {
+                ret.sample_size_offsets.reserve(stsz.sample_sizes.len() + 1);
+                ret.sample_size_offsets.push(0);
+                let mut offset = 0;
+                for &size in &stsz.sample_sizes {
+                    offset += size as u64;
+                    ret.sample_size_offsets.push(offset);
+                }
+            }
+        }
+
+        ret
+    }
+
+    // Provides the time for the given zero-based sample.
+    pub fn sample_time(&self, sample: u64) -> Option<u64> {
+        let i = self.time_to_sample.partition_point(|run| run.first_sample + run.sample_count <= sample);
+        match self.time_to_sample.get(i) {
+            Some(run) => Some(run.start_time + (sample - run.first_sample) * run.sample_duration),
+            None => match self.time_to_sample.last() {
+                Some(last) if last.first_sample + last.sample_count == sample => Some(last.end_time()),
+                None if sample == 0 => Some(0),
+                _ => None,
+            },
+        }
+    }
+
+    // Returns the zero-based sample that is being presented at the given time along with the
+    // time that sample begins at. Samples with zero durations are never returned.
+    pub fn sample_at_time(&self, time: u64) -> Option<(u64, u64)> {
+        // any run that ends after the given time has a non-zero duration
+        let run = self.time_to_sample.get(self.time_to_sample.partition_point(|run| run.end_time() <= time))?;
+        let relative_sample = (time - run.start_time) / run.sample_duration;
+        Some((run.first_sample + relative_sample, run.start_time + relative_sample * run.sample_duration))
+    }
+
+    // Returns the number of samples that begin before the given time, or None if the time is
+    // beyond the end of the track.
+    pub fn samples_before_time(&self, time: u64) -> Option<u64> {
+        let i = self.time_to_sample.partition_point(|run| run.end_time() < time);
+        let run = self.time_to_sample[i..].iter().find(|run| run.sample_duration > 0)?;
+        Some(run.first_sample + (time - run.start_time).div_ceil(run.sample_duration))
+    }
+
+    // Returns info for the chunk that the given zero-based sample number is in.
+    pub fn sample_chunk_info(&self, sample: u64) -> Option<SampleChunkInfo> {
+        let entry = self.sample_to_chunk.partition_point(|run| run.first_sample <= sample).max(1) - 1;
+        let run = self.sample_to_chunk.get(entry)?;
+        let relative = ((sample - run.first_sample) / (run.samples_per_chunk as u64)) as u32;
+        Some(SampleChunkInfo {
+            number: run.first_chunk - 1 + relative,
+            first_sample: run.first_sample + relative as u64 * run.samples_per_chunk as u64,
+            samples: run.samples_per_chunk as _,
+            entry,
+            entry_first_sample: run.first_sample,
+            sample_description: run.sample_description,
+        })
+    }
+
+    fn constant_sample_size(&self, chunk_info: &SampleChunkInfo) -> Option<Option<u32>> {
+        if !self.has_sample_size {
+            return None;
+        }
+        self.description_sample_sizes.get(chunk_info.sample_description as usize).copied()
+    }
+
+    // Returns the size of the given zero-based sample.
+    pub fn sample_size(&self, sample: u64) -> Option<u32> {
+        let chunk_info = self.sample_chunk_info(sample)?;
+        match self.constant_sample_size(&chunk_info)? {
+            Some(size) => Some(size),
+            None => {
+                let n = sample as usize;
+                if n + 1 < self.sample_size_offsets.len() {
+                    Some((self.sample_size_offsets[n + 1] - self.sample_size_offsets[n]) as u32)
+                } else {
+                    None
+                }
+            }
+        }
+    }
+
+    // Returns the offset within the file of the given zero-based sample.
+    pub fn sample_offset(&self, sample: u64) -> Option<u64> {
+        let chunk_info = self.sample_chunk_info(sample)?;
+        let chunk_offset = *self.chunk_offsets.get(chunk_info.number as usize)?;
+        let offset_in_chunk = match self.constant_sample_size(&chunk_info)? {
+            Some(size) => size as u64 * (sample - chunk_info.first_sample),
+            None => {
+                let n = sample as usize;
+                if n + 1 < self.sample_size_offsets.len() {
+                    self.sample_size_offsets[n] - self.sample_size_offsets[chunk_info.first_sample as usize]
+                } else {
+                    return None;
+                }
+            }
+        };
+        Some(chunk_offset + offset_in_chunk)
+    }
+
+    // Returns the range of bytes within the file that hold the given zero-based sample.
+    pub fn sample_range(&self, sample: u64) -> Option<Range<u64>> {
+        let offset = self.sample_offset(sample)?;
+        Some(offset..offset + self.sample_size(sample)? as u64)
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use crate::data::{
+        ChunkOffsetData, GeneralMediaType, GeneralSampleDescriptionDataEntry, SampleDescriptionData, SampleSizeData, SampleToChunkData, SampleToChunkDataEntry,
+        TimeToSampleData, TimeToSampleDataEntry,
+    };
+
+    fn sample_table() -> SampleTableData<GeneralMediaType> {
+        SampleTableData::<GeneralMediaType> {
+            sample_description: Some(SampleDescriptionData {
+                entries: vec![GeneralSampleDescriptionDataEntry {
+                    data_format: 0,
+                    reserved: [0; 6],
+                    data_reference_index: 1,
+                }],
+            }),
+            time_to_sample: Some(TimeToSampleData {
+                entries: [(3, 10), (2, 0), (4, 20), (1, 5)]
+                    .iter()
+                    .map(|&(sample_count, sample_duration)| TimeToSampleDataEntry { sample_count, sample_duration })
+                    .collect(),
+                ..Default::default()
+            }),
+            sample_to_chunk: Some(SampleToChunkData {
+                entries: [(1, 2), (3, 1), (4, 3)]
+                    .iter()
+                    .map(|&(first_chunk, samples_per_chunk)| SampleToChunkDataEntry {
+                        first_chunk,
+                        samples_per_chunk,
+                        sample_description_id: 1,
+                    })
+                    .collect(),
+                ..Default::default()
+            }),
+            sample_size: Some(SampleSizeData {
+                sample_count: 10,
+                sample_sizes: (1..=10).collect(),
+                ..Default::default()
+            }),
+            chunk_offset: Some(ChunkOffsetData {
+                offsets: vec![1000, 2000, 3000, 4000, 5000],
+                ..Default::default()
+            }),
+            chunk_offset_64: None,
+        }
+    }
+
+    #[test]
+    fn test_sample_index() {
+        let table = sample_table();
+        let stts = table.time_to_sample.as_ref().unwrap();
+        let index = SampleIndex::new(&table);
+
+        for sample in 0..12 {
+            assert_eq!(index.sample_time(sample), stts.sample_time(sample), "sample {}", sample);
+
+            let chunk_info = table.sample_chunk_info(sample, None);
+            assert_eq!(index.sample_chunk_info(sample), chunk_info, "sample {}", sample);
+            let chunk_info = chunk_info.unwrap();
+            assert_eq!(index.sample_offset(sample), table.sample_offset(sample, &chunk_info), "sample {}", sample);
+            assert_eq!(index.sample_size(sample), table.sample_size(sample, &chunk_info), "sample {}", sample);
+        }
+
+        assert_eq!(index.sample_at_time(0), Some((0, 0)));
+        assert_eq!(index.sample_at_time(29), Some((2, 20)));
+        assert_eq!(index.sample_at_time(30), Some((5, 30)));
+        assert_eq!(index.sample_at_time(109), Some((8, 90)));
+        assert_eq!(index.sample_at_time(114), Some((9, 110)));
+        assert_eq!(index.sample_at_time(115), None);
+
+        assert_eq!(index.samples_before_time(0), Some(0));
+        assert_eq!(index.samples_before_time(30), Some(3));
+        assert_eq!(index.samples_before_time(31), Some(6));
+        assert_eq!(index.samples_before_time(115), Some(10));
+        assert_eq!(index.samples_before_time(116), None);
+
+        assert_eq!(index.sample_range(0), Some(1000..1001));
+        assert_eq!(index.sample_range(1), Some(1001..1003));
+        assert_eq!(index.sample_range(5), Some(4000..4006));
+        assert_eq!(index.sample_range(7), Some(4013..4021));
+        assert_eq!(index.sample_range(10), None);
+    }
+}
@@ -0,0 +1,122 @@
+//! Benchmarks many async stream pairs connected over loopback, all served by the epoll reactors,
+//! for several reactor shard counts.
+
+use criterion::{criterion_group, criterion_main, Criterion, Throughput};
+use srt::{set_epoll_reactor_shards, AsyncListener, AsyncStream, ConnectOptions, ListenerOption};
+use tokio::{
+    io::{AsyncReadExt, AsyncWriteExt},
+    join,
+    runtime::Runtime,
+};
+
+const PAYLOAD_LEN: usize = 1316;
+const PACKETS_PER_ITERATION: usize = 8;
+
+/// Connects the given number of client/server stream pairs.
+fn connect(rt: &Runtime, port: u16, pairs: usize) -> Vec<(AsyncStream, AsyncStream)> {
+    rt.block_on(async {
+        let addr = format!("127.0.0.1:{}", port);
+        let listener = AsyncListener::bind_with_options(
+            &addr,
+            [
+                ListenerOption::TimestampBasedPacketDeliveryMode(false),
+                ListenerOption::TooLatePacketDrop(false),
+            ]
+            .iter()
+            .cloned(),
+        )
+        .unwrap();
+        let options = ConnectOptions {
+            timestamp_based_packet_delivery_mode: Some(false),
+            too_late_packet_drop: Some(false),
+            ..Default::default()
+        };
+        let mut ret = Vec::with_capacity(pairs);
+        for _ in 0..pairs {
+            let (accept_result, connect_result) = join!(listener.accept(), AsyncStream::connect(&addr, &options));
+            ret.push((connect_result.unwrap(), accept_result.unwrap().0));
+        }
+        ret
+    })
+}
+
+/// Runs f on every pair concurrently, then puts the pairs back.
+fn for_each_pair<F, Fut>(rt: &Runtime, pairs: &mut Vec<(AsyncStream, AsyncStream)>, f: F)
+where
+    F: Fn(AsyncStream, AsyncStream) -> Fut,
+    Fut: std::future::Future<Output = (AsyncStream, AsyncStream)> + Send + 'static,
+{
+    rt.block_on(async {
+        let tasks = pairs.drain(..).map(|(client, server)| tokio::spawn(f(client, server))).collect::<Vec<_>>();
+        for task in tasks {
+            pairs.push(task.await.unwrap());
+        }
+    })
+}
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let rt = Runtime::new().unwrap();
+
+    let cpus = std::thread::available_parallelism().map(|n| n.get()).unwrap_or(1);
+    let mut shard_counts = vec![1, 2, 4, cpus];
+    shard_counts.sort_unstable();
+    shard_counts.dedup();
+
+    let mut port = 1250;
+    for &shards in &shard_counts {
+        for &pair_count in &[1, 16, 64, 256] {
+            // The reactors are shut down when the previous pairs are dropped, so the new shard
+            // count takes effect when these are connected.
+            set_epoll_reactor_shards(shards);
+            let mut pairs = connect(&rt, port, pair_count);
+            port += 1;
+            bench_pairs(c, &rt, &mut pairs, &format!("shards={}/pairs={}", shards, pair_count));
+        }
+    }
+}
+
+/// Runs both benchmarks on the given connected pairs.
+fn bench_pairs(c: &mut Criterion, rt: &Runtime, pairs: &mut Vec<(AsyncStream, AsyncStream)>, id: &str) {
+    let pair_count = pairs.len();
+
+    // Each pair sends a burst of packets one way.
+    let mut group = c.benchmark_group("loopback_throughput");
+    group.throughput(Throughput::Bytes((pair_count * PACKETS_PER_ITERATION * PAYLOAD_LEN) as _));
+    group.bench_function(id, |b| {
+        b.iter(|| {
+            for_each_pair(rt, pairs, |mut client, mut server| async move {
+                let payload = [0x5a; PAYLOAD_LEN];
+                let mut buf = [0; PAYLOAD_LEN];
+                for _ in 0..PACKETS_PER_ITERATION {
+                    client.write_all(&payload).await.unwrap();
+                }
+                for _ in 0..PACKETS_PER_ITERATION {
+                    assert_eq!(server.read(&mut buf).await.unwrap(), PAYLOAD_LEN);
+                }
+                (client, server)
+            })
+        })
+    });
+    group.finish();
+
+    // Each pair does a round trip, so each iteration measures two reactor wake-ups per pair.
+    let mut group = c.benchmark_group("loopback_round_trip");
+    group.throughput(Throughput::Elements(pair_count as _));
+    group.bench_function(id, |b| {
+        b.iter(|| {
+            for_each_pair(rt, pairs, |mut client, mut server| async move {
+                // reads must have room for a full payload, even if the message is smaller
+                let mut buf = [0; PAYLOAD_LEN];
+                client.write_all(b"ping").await.unwrap();
+                assert_eq!(server.read(&mut buf).await.unwrap(), 4);
+                server.write_all(b"pong").await.unwrap();
+                assert_eq!(client.read(&mut buf).await.unwrap(), 4);
+                (client, server)
+            })
+        })
+    });
+    group.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
@@ -8,7 +8,10 @@ use std::{
     io, mem,
     net::{SocketAddr, ToSocketAddrs},
     pin::Pin,
-    sync::Arc,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc,
+    },
     task::{Context, Poll},
 };
 use tokio::{
@@ -16,6 +19,21 @@ use tokio::{
     task::{spawn_blocking, JoinError, JoinHandle},
 };
 
+static EPOLL_REACTOR_SHARDS: AtomicUsize = AtomicUsize::new(1);
+
+/// Sets the number of epoll reactors that async streams are spread across. Each one has its own
+/// thread. By default, there is just one. Values less than one are treated as one.
+///
+/// The reactors are started when the first async stream is created, so this only takes effect if
+/// called before then, or after all async streams and listeners have been dropped.
+pub fn set_epoll_reactor_shards(shards: usize) {
+    EPOLL_REACTOR_SHARDS.store(shards, Ordering::Relaxed);
+}
+
+pub(crate) fn epoll_reactor_shards() -> usize {
+    EPOLL_REACTOR_SHARDS.load(Ordering::Relaxed).max(1)
+}
+
 impl From<JoinError> for Error {
     fn from(e: JoinError) -> Error {
         Error::JoinError(e)
@@ -25,6 +43,7 @@ impl From<JoinError> for Error {
 pub struct AsyncListener<'c> {
     socket: Socket,
     _callback: Option<Pin<Box<Box<dyn ListenerCallback + 'c>>>>,
+    epoll_reactor_shard: Option<usize>,
 }
 
 impl AsyncListener<'static> {
@@ -46,7 +65,11 @@ impl AsyncListener<'static> {
         unsafe {
             check_code("srt_listen", sys::srt_listen(socket.raw(), 10))?;
         }
-        Ok(Self { socket, _callback: None })
+        Ok(Self {
+            socket,
+            _callback: None,
+            epoll_reactor_shard: None,
+        })
     }
 }
 
@@ -61,9 +84,19 @@ impl<'c> AsyncListener<'c> {
         Ok(AsyncListener {
             _callback: Some(pb),
             socket: self.socket,
+            epoll_reactor_shard: self.epoll_reactor_shard,
         })
     }
 
+    /// Sets the epoll reactor shard that accepted streams use. See [`set_epoll_reactor_shards`]. By
+    /// default, the shard with the fewest streams is used.
+    pub fn with_epoll_reactor_shard(self, shard: usize) -> Self {
+        Self {
+            epoll_reactor_shard: Some(shard),
+            ..self
+        }
+    }
+
     pub async fn accept(&self) -> Result<(AsyncStream, SocketAddr)> {
         Accept {
             listener: self,
@@ -91,6 +124,7 @@ impl<'a, 'c> Future for Accept<'a, 'c> {
             State::Idle => {
                 let sock = self.listener.socket.raw();
                 let api = self.listener.socket.api.clone();
+                let shard = self.listener.epoll_reactor_shard;
                 // TODO: use epoll instead of spawn_blocking
                 let mut handle = spawn_blocking(move || {
                     let mut storage = mem::MaybeUninit::<sys::sockaddr_storage>::zeroed();
@@ -99,7 +133,7 @@ impl<'a, 'c> Future for Accept<'a, 'c> {
                     let socket = Socket { api, sock };
                     let storage = unsafe { storage.assume_init() };
                     let addr = sockaddr_from_storage(&storage, len)?;
-                    Ok((AsyncStream::new(socket.get(sys::SRT_SOCKOPT_SRTO_STREAMID)?, socket)?, addr))
+                    Ok((AsyncStream::new(socket.get(sys::SRT_SOCKOPT_SRTO_STREAMID)?, socket, shard)?, addr))
                 });
                 let ret = Pin::new(&mut handle).poll(cx);
                 self.state = State::Busy(handle);
@@ -122,14 +156,14 @@ pub struct AsyncStream {
 }
 
 impl AsyncStream {
-    fn new(id: Option<String>, socket: Socket) -> Result<Self> {
+    fn new(id: Option<String>, socket: Socket, epoll_reactor_shard: Option<usize>) -> Result<Self> {
         socket.set(sys::SRT_SOCKOPT_SRTO_SNDSYN, false)?;
         socket.set(sys::SRT_SOCKOPT_SRTO_RCVSYN, false)?;
         let max_send_payload_size = socket
             .get::<i32>(sys::SRT_SOCKOPT_SRTO_PAYLOADSIZE)
             .expect("SRT should have a default payload size if not set") as _;
         Ok(Self {
-            epoll_reactor: socket.api.get_epoll_reactor()?,
+            epoll_reactor: socket.api.get_epoll_reactor(epoll_reactor_shard)?,
             socket,
             id,
             max_send_payload_size,
@@ -156,6 +190,11 @@ impl AsyncStream {
         self.id.as_ref()
     }
 
+    /// Returns the epoll reactor shard used by the stream.
+    pub fn epoll_reactor_shard(&self) -> usize {
+        self.epoll_reactor.shard()
+    }
+
     /// Returns the underlying stats for the socket.
     ///
     /// Refer to https://github.com/Haivision/srt/blob/v1.4.4/docs/API/statistics.md to learn more about them.
@@ -186,7 +225,7 @@ impl Future for Connect {
                     unsafe {
                         check_code("srt_connect", sys::srt_connect(socket.raw(), &addr as *const _ as _, len as _))?;
                     }
-                    AsyncStream::new(options.stream_id, socket)
+                    AsyncStream::new(options.stream_id, socket, options.epoll_reactor_shard)
                 });
                 let ret = Pin::new(&mut handle).poll(cx);
                 self.state = State::Busy(handle);
@@ -334,6 +373,30 @@ mod test {
         assert!(server_conn.read(&mut buf).await.is_err());
     }
 
+    #[tokio::test]
+    async fn test_async_epoll_reactor_shard() {
+        let listener = AsyncListener::bind("127.0.0.1:1239").unwrap().with_epoll_reactor_shard(1);
+
+        let options = ConnectOptions {
+            epoll_reactor_shard: Some(0),
+            ..Default::default()
+        };
+        let (accept_result, connect_result) = join!(listener.accept(), AsyncStream::connect("127.0.0.1:1239", &options));
+        let mut server_conn = accept_result.unwrap().0;
+        let mut client_conn = connect_result.unwrap();
+        assert_eq!(server_conn.epoll_reactor_shard(), 1 % epoll_reactor_shards());
+        assert_eq!(client_conn.epoll_reactor_shard(), 0);
+
+        let mut buf = [0; 1316];
+        for _ in 0..3 {
+            assert_eq!(client_conn.write(b"ping").await.unwrap(), 4);
+            assert_eq!(server_conn.read(&mut buf).await.unwrap(), 4);
+            assert_eq!(server_conn.write(b"pong").await.unwrap(), 4);
+            assert_eq!(client_conn.read(&mut buf).await.unwrap(), 4);
+            assert_eq!(&buf[..4], b"pong");
+        }
+    }
+
     #[tokio::test]
     async fn test_async_passphrase() {
         let listener = AsyncListener::bind_with_options("127.0.0.1:1237", [ListenerOption::TooLatePacketDrop(false)].iter().cloned())
@@ -3,7 +3,7 @@ use libc::c_int as int;
 use std::{
     collections::{HashMap, HashSet},
     io::Write,
-    net,
+    mem, net,
     os::unix::{io::IntoRawFd, net::UnixStream},
     sync::{Arc, Mutex},
     task::Waker,
@@ -16,8 +16,44 @@ struct Wakers {
     write_waker: Option<Waker>,
 }
 
+/// A set of epoll reactors, each with its own epoll instance, thread, and lock. Sockets are spread
+/// across the shards so that no single lock or thread is shared by all of them.
+pub(crate) struct ShardedEpollReactor {
+    shards: Vec<Arc<EpollReactor>>,
+}
+
+impl ShardedEpollReactor {
+    pub fn new(shards: usize) -> Result<Self> {
+        Ok(Self {
+            shards: (0..shards.max(1)).map(|i| EpollReactor::new(i).map(Arc::new)).collect::<Result<_>>()?,
+        })
+    }
+
+    /// Returns the given shard, or if None, the shard with the fewest sockets using it.
+    pub fn shard(&self, shard: Option<usize>) -> Arc<EpollReactor> {
+        let shard = match shard {
+            Some(shard) => &self.shards[shard % self.shards.len()],
+            // Each socket using a shard holds a reference to it, so the reference count doubles as
+            // the shard's load.
+            None => self
+                .shards
+                .iter()
+                .min_by_key(|s| Arc::strong_count(s))
+                .expect("there should be at least one shard"),
+        };
+        shard.clone()
+    }
+
+    /// Consumes the reactor, stopping all of the shards' threads. Returns false if any shard is
+    /// still in use, in which case its thread is left running.
+    pub fn shut_down(self) -> bool {
+        self.shards.into_iter().all(|shard| Arc::try_unwrap(shard).is_ok())
+    }
+}
+
 pub(crate) struct EpollReactor {
     eid: int,
+    shard: usize,
     join_handle: Option<thread::JoinHandle<()>>,
     pipe: UnixStream,
     wakers: Arc<Mutex<HashMap<sys::SRTSOCKET, Wakers>>>,
@@ -27,22 +63,45 @@ pub const READ_EVENTS: int = sys::SRT_EPOLL_OPT_SRT_EPOLL_ERR as int | sys::SRT_
 pub const WRITE_EVENTS: int = sys::SRT_EPOLL_OPT_SRT_EPOLL_ERR as int | sys::SRT_EPOLL_OPT_SRT_EPOLL_OUT as int;
 pub const READ_WRITE_EVENTS: int = READ_EVENTS | WRITE_EVENTS;
 
+/// The number of sockets the reactor can receive events for in one wait before its event buffers
+/// need to grow.
+const INITIAL_EVENT_CAPACITY: usize = 64;
+
 impl EpollReactor {
-    pub fn new() -> Result<Self> {
+    pub fn new(shard: usize) -> Result<Self> {
         let eid = match unsafe { sys::srt_epoll_create() } {
             -1 => return Err(new_srt_error("srt_epoll_create")),
             id => id,
         };
         let (pipe_a, pipe_b) = UnixStream::pair()?;
         let wakers = Arc::new(Mutex::new(HashMap::new()));
+        let join_handle = {
+            let wakers = wakers.clone();
+            thread::Builder::new()
+                .name(format!("srt-epoll-{}", shard))
+                .spawn(move || Self::run(eid, wakers, pipe_b))
+        };
+        let join_handle = match join_handle {
+            Ok(join_handle) => join_handle,
+            Err(e) => {
+                unsafe { sys::srt_epoll_release(eid) };
+                return Err(e.into());
+            }
+        };
         Ok(Self {
             eid,
+            shard,
             pipe: pipe_a,
-            wakers: wakers.clone(),
-            join_handle: Some(thread::spawn(move || Self::run(eid, wakers, pipe_b))),
+            wakers,
+            join_handle: Some(join_handle),
         })
     }
 
+    /// Returns the index of the reactor within its ShardedEpollReactor.
+    pub fn shard(&self) -> usize {
+        self.shard
+    }
+
     pub fn wake_when_read_ready(&self, s: &Socket, waker: Waker) {
         let s = s.raw();
         let mut wakers = self.wakers.lock().expect("the lock should not be poisoned");
@@ -102,11 +161,12 @@ impl EpollReactor {
     fn run(eid: int, wakers: Arc<Mutex<HashMap<sys::SRTSOCKET, Wakers>>>, pipe: UnixStream) {
         unsafe { sys::srt_epoll_add_ssock(eid, pipe.into_raw_fd(), &READ_EVENTS) };
 
-        let mut readfds = [0; 200];
-        let mut writefds = [0; 200];
+        let mut readfds = vec![0; INITIAL_EVENT_CAPACITY];
+        let mut writefds = vec![0; INITIAL_EVENT_CAPACITY];
         let mut sys_readfds = [0; 1];
         let mut sys_writefds = [0; 1];
         let mut removed = HashSet::new();
+        let mut ready_wakers = Vec::new();
 
         loop {
             let mut rnum = readfds.len() as int;
@@ -133,14 +193,16 @@ impl EpollReactor {
             }
 
             if rnum > 0 || wnum > 0 {
+                let rnum = readfds.len().min(rnum as _);
+                let wnum = writefds.len().min(wnum as _);
                 removed.clear();
                 let mut wakers = wakers.lock().expect("the lock should not be poisoned");
 
-                for &fd in &readfds[..readfds.len().min(rnum as _)] {
+                for &fd in &readfds[..rnum] {
                     match wakers.get_mut(&fd) {
                         Some(fd_wakers) => {
                             if let Some(waker) = fd_wakers.read_waker.take() {
-                                waker.wake();
+                                ready_wakers.push(waker);
                             }
                             if fd_wakers.write_waker.is_some() {
                                 unsafe { sys::srt_epoll_update_usock(eid, fd, &WRITE_EVENTS) };
@@ -157,11 +219,11 @@ impl EpollReactor {
                     }
                 }
 
-                for &fd in &writefds[..writefds.len().min(wnum as _)] {
+                for &fd in &writefds[..wnum] {
                     match wakers.get_mut(&fd) {
                         Some(fd_wakers) => {
                             if let Some(waker) = fd_wakers.write_waker.take() {
-                                waker.wake();
+                                ready_wakers.push(waker);
                             }
                             if fd_wakers.read_waker.is_some() {
                                 unsafe { sys::srt_epoll_update_usock(eid, fd, &READ_EVENTS) };
@@ -180,6 +242,23 @@ impl EpollReactor {
                         }
                     }
                 }
+
+                // Wake the tasks after releasing the lock so that they don't contend with us for it
+                // when they poll again.
+                mem::drop(wakers);
+                for waker in ready_wakers.drain(..) {
+                    waker.wake();
+                }
+
+                // If a buffer was filled, there may have been more ready sockets than fit. They'll
+                // be returned by the next wait, but grow the buffer so that it's less likely next
+                // time.
+                if rnum == readfds.len() {
+                    readfds.resize(readfds.len() * 2, 0);
+                }
+                if wnum == writefds.len() {
+                    writefds.resize(writefds.len() * 2, 0);
+                }
             }
         }
     }
@@ -204,7 +283,26 @@ mod test {
 
     #[test]
     fn test_epoll_reactor() {
-        let reactor = EpollReactor::new();
+        let reactor = EpollReactor::new(0);
         std::mem::drop(reactor);
     }
+
+    #[test]
+    fn test_sharded_epoll_reactor() {
+        let reactor = ShardedEpollReactor::new(3).unwrap();
+
+        // Shards should be handed out to balance their load.
+        let a = reactor.shard(None);
+        let b = reactor.shard(None);
+        let c = reactor.shard(None);
+        assert_eq!((a.shard(), b.shard(), c.shard()), (0, 1, 2));
+        std::mem::drop(b);
+        assert_eq!(reactor.shard(None).shard(), 1);
+
+        // Explicitly requested shards wrap around.
+        assert_eq!(reactor.shard(Some(4)).shard(), 1);
+
+        std::mem::drop((a, c));
+        assert!(reactor.shut_down());
+    }
 }
@@ -101,7 +101,7 @@ struct Api {
 #[derive(Default)]
 struct ApiState {
     #[cfg(feature = "async")]
-    epoll_reactor: Mutex<Option<Arc<epoll_reactor::EpollReactor>>>,
+    epoll_reactor: Mutex<Option<epoll_reactor::ShardedEpollReactor>>,
     ref_count: AtomicUsize,
 }
 
@@ -111,16 +111,13 @@ lazy_static! {
 
 impl Api {
     #[cfg(feature = "async")]
-    fn get_epoll_reactor(&self) -> Result<Arc<epoll_reactor::EpollReactor>> {
+    fn get_epoll_reactor(&self, shard: Option<usize>) -> Result<Arc<epoll_reactor::EpollReactor>> {
         let mut api_reactor = self.state.epoll_reactor.lock().expect("the lock should not be poisoned");
-        match &*api_reactor {
-            Some(api_reactor) => Ok(api_reactor.clone()),
-            None => {
-                let r = Arc::new(epoll_reactor::EpollReactor::new()?);
-                *api_reactor = Some(r.clone());
-                Ok(r)
-            }
-        }
+        let api_reactor = match &mut *api_reactor {
+            Some(api_reactor) => api_reactor,
+            None => api_reactor.insert(epoll_reactor::ShardedEpollReactor::new(async_lib::epoll_reactor_shards())?),
+        };
+        Ok(api_reactor.shard(shard))
     }
 
     fn get() -> Result<Arc<Api>> {
@@ -143,7 +140,7 @@ impl Drop for Api {
         if api_state.ref_count.fetch_sub(1, std::sync::atomic::Ordering::SeqCst) == 1 {
             #[cfg(feature = "async")]
             if let Some(reactor) = api_state.epoll_reactor.lock().expect("the lock should not be poisoned").take() {
-                if Arc::try_unwrap(reactor).is_err() {
+                if !reactor.shut_down() {
                     panic!("the api must have the last strong reference to the reactor");
                 }
             }
@@ -543,6 +540,10 @@ pub struct ConnectOptions {
     pub send_buffer_size: Option<i32>,
     pub max_bandwidth: Option<MaxBandwidth>,
     pub max_send_payload_size: Option<i32>,
+    /// The epoll reactor shard that async streams should use. See [`set_epoll_reactor_shards`].
+    /// If None, the shard with the fewest streams is used.
+    #[cfg(feature = "async")]
+    pub epoll_reactor_shard: Option<usize>,
 }
 
 impl Stream {
@@ -0,0 +1,103 @@
+//! Benchmarks encoding synthetic 720p video with a single encoder and with chunked encoders of
+//! increasing numbers of workers. Throughput is reported in frames per second.
+//!
+//! The chunked encoders' x264 instances each use one thread, so that scaling comes only from the
+//! workers. The single encoder is measured with one thread and with x264's own threading.
+
+use av_traits::{EncodedFrameType, RawVideoFrame, VideoEncoder};
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use std::sync::Arc;
+use x264::{ChunkedEncoder, ChunkedEncoderConfig, X264Encoder, X264EncoderConfig, X264EncoderInputFormat};
+
+const WIDTH: usize = 1280;
+const HEIGHT: usize = 720;
+const FRAMES: usize = 240;
+const CHUNK_FRAMES: usize = 30;
+
+// Frames are shared so that each iteration doesn't have to copy them.
+#[derive(Clone)]
+struct Frame(Arc<Vec<Vec<u8>>>);
+
+impl RawVideoFrame<u8> for Frame {
+    fn samples(&self, plane: usize) -> &[u8] {
+        &self.0[plane]
+    }
+}
+
+// Returns frames of a gradient with a bar that moves across it, so that there's some motion to
+// encode.
+fn frames() -> Vec<Frame> {
+    (0..FRAMES)
+        .map(|i| {
+            let mut y = Vec::with_capacity(WIDTH * HEIGHT);
+            for line in 0..HEIGHT {
+                for x in 0..WIDTH {
+                    y.push(if (x + i * 8) % WIDTH < 64 {
+                        235
+                    } else {
+                        (16 + (line + x) * 219 / (WIDTH + HEIGHT)) as u8
+                    });
+                }
+            }
+            Frame(Arc::new(vec![y, vec![128; WIDTH * HEIGHT / 4], vec![128; WIDTH * HEIGHT / 4]]))
+        })
+        .collect()
+}
+
+fn config() -> X264EncoderConfig {
+    X264EncoderConfig {
+        width: WIDTH as _,
+        height: HEIGHT as _,
+        bitrate: Some(5000),
+        fps: 30.0,
+        input_format: X264EncoderInputFormat::Yuv420Planar,
+    }
+}
+
+fn encode<E: VideoEncoder<RawVideoFrame = Frame>>(mut encoder: E, frames: &[Frame]) -> usize
+where
+    E::Error: std::fmt::Debug,
+{
+    let mut encoded = 0;
+    for frame in frames {
+        encoded += encoder.encode(frame.clone(), EncodedFrameType::Auto).unwrap().is_some() as usize;
+    }
+    while encoder.flush().unwrap().is_some() {
+        encoded += 1;
+    }
+    encoded
+}
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let frames = frames();
+    let max_workers = std::thread::available_parallelism().map(|n| n.get()).unwrap_or(1).min(8);
+
+    let mut g = c.benchmark_group("x264");
+    g.throughput(Throughput::Elements(FRAMES as _));
+    g.sample_size(10);
+    g.bench_function("single", |b| {
+        b.iter(|| assert_eq!(encode(X264Encoder::with_threads(config(), 1).unwrap(), &frames), FRAMES));
+    });
+    g.bench_function("single_x264_threads", |b| {
+        b.iter(|| assert_eq!(encode(X264Encoder::new(config()).unwrap(), &frames), FRAMES));
+    });
+    for workers in 1..=max_workers {
+        g.bench_with_input(BenchmarkId::new("chunked", workers), &workers, |b, &workers| {
+            b.iter(|| {
+                let encoder = ChunkedEncoder::new(
+                    ChunkedEncoderConfig {
+                        chunk_frames: CHUNK_FRAMES,
+                        workers,
+                    },
+                    || X264Encoder::with_threads(config(), 1),
+                )
+                .unwrap();
+                assert_eq!(encode(encoder, &frames), FRAMES);
+            })
+        });
+    }
+    g.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
@@ -0,0 +1,454 @@
+use av_traits::{EncodedFrameType, VideoEncoder, VideoEncoderOutput};
+use std::{
+    collections::VecDeque,
+    io, mem,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        mpsc::{self, TryRecvError},
+        Arc, Mutex,
+    },
+    thread,
+};
+
+#[derive(Clone, Debug)]
+pub struct ChunkedEncoderConfig {
+    /// The number of frames in each chunk. Every chunk is encoded independently by its own encoder
+    /// instance and starts with a keyframe, so chunks never reference each other.
+    pub chunk_frames: usize,
+
+    /// The number of encoder instances to run at once, each on its own thread.
+    pub workers: usize,
+}
+
+type Chunk<F, E> = (Vec<(F, EncodedFrameType)>, mpsc::SyncSender<Result<VideoEncoderOutput<F>, E>>);
+
+struct PendingChunk<F, E> {
+    outputs: mpsc::Receiver<Result<VideoEncoderOutput<F>, E>>,
+
+    // the number of frames in the chunk that haven't been returned yet
+    frames: usize,
+}
+
+/// Encodes video by splitting it into fixed-length chunks, which are encoded in parallel by
+/// separate encoder instances.
+///
+/// Output is returned in the original order. No more than `2 * workers * chunk_frames` frames are
+/// held at once: once that many are in flight, `encode` blocks until the next frame is output.
+///
+/// Encoders are created for each chunk rather than reused, since x264 can't accept more frames
+/// once it has been flushed.
+pub struct ChunkedEncoder<E: VideoEncoder> {
+    config: ChunkedEncoderConfig,
+    chunk: Vec<(E::RawVideoFrame, EncodedFrameType)>,
+    chunks: Option<mpsc::SyncSender<Chunk<E::RawVideoFrame, E::Error>>>,
+    pending: VecDeque<PendingChunk<E::RawVideoFrame, E::Error>>,
+    frames_in_flight: usize,
+    workers: Vec<thread::JoinHandle<()>>,
+
+    // set when the encoder is dropped, so that workers abandon their chunks without finishing them
+    cancelled: Arc<AtomicBool>,
+}
+
+impl<E> ChunkedEncoder<E>
+where
+    E: VideoEncoder + 'static,
+    E::RawVideoFrame: Send + 'static,
+    E::Error: Send + 'static,
+{
+    /// Creates a chunked encoder. `new_encoder` is invoked on the worker threads to create an encoder
+    /// for each chunk. An `InvalidInput` error is returned if `chunk_frames` or `workers` is zero.
+    pub fn new<N>(config: ChunkedEncoderConfig, new_encoder: N) -> io::Result<Self>
+    where
+        N: Fn() -> Result<E, E::Error> + Send + Sync + 'static,
+    {
+        if config.chunk_frames == 0 || config.workers == 0 {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                "chunk_frames and workers must be greater than zero",
+            ));
+        }
+
+        let new_encoder = Arc::new(new_encoder);
+        let (chunks_tx, chunks_rx) = mpsc::sync_channel::<Chunk<E::RawVideoFrame, E::Error>>(config.workers);
+        let chunks_rx = Arc::new(Mutex::new(chunks_rx));
+        let mut ret = Self {
+            chunk: Vec::with_capacity(config.chunk_frames),
+            chunks: Some(chunks_tx),
+            pending: VecDeque::new(),
+            frames_in_flight: 0,
+            workers: Vec::with_capacity(config.workers),
+            cancelled: Arc::new(AtomicBool::new(false)),
+            config,
+        };
+
+        for i in 0..ret.config.workers {
+            let new_encoder = new_encoder.clone();
+            let chunks_rx = chunks_rx.clone();
+            let cancelled = ret.cancelled.clone();
+            let worker = thread::Builder::new().name(format!("chunked-encoder-{}", i)).spawn(move || loop {
+                // the lock is released as soon as a chunk is received, so idle workers take turns waiting
+                let chunk = chunks_rx.lock().expect("the lock shouldn't be poisoned").recv();
+                match chunk {
+                    Ok((frames, outputs)) => encode_chunk(&*new_encoder, &cancelled, frames, outputs),
+                    Err(_) => return,
+                }
+            });
+            // on failure, dropping ret stops the workers that did start
+            ret.workers.push(worker?);
+        }
+
+        Ok(ret)
+    }
+
+    fn send_chunk(&mut self) {
+        if self.chunk.is_empty() {
+            return;
+        }
+        let frames = mem::replace(&mut self.chunk, Vec::with_capacity(self.config.chunk_frames));
+        // the worker never has to wait on the output, even if the chunk fails after every frame
+        let (outputs_tx, outputs_rx) = mpsc::sync_channel(frames.len() + 1);
+        self.pending.push_back(PendingChunk {
+            outputs: outputs_rx,
+            frames: frames.len(),
+        });
+        if let Some(chunks) = &self.chunks {
+            // if the workers are gone, the chunk's outputs will just be disconnected
+            let _ = chunks.send((frames, outputs_tx));
+        }
+    }
+
+    // Returns the next output in order. If `block` is false, only output that is already available
+    // is returned.
+    fn next_output(&mut self, block: bool) -> Result<Option<VideoEncoderOutput<E::RawVideoFrame>>, E::Error> {
+        while let Some(chunk) = self.pending.front_mut() {
+            let output = if block {
+                chunk.outputs.recv().map_err(|_| TryRecvError::Disconnected)
+            } else {
+                chunk.outputs.try_recv()
+            };
+            match output {
+                Ok(output) => {
+                    if output.is_ok() {
+                        chunk.frames -= 1;
+                        self.frames_in_flight -= 1;
+                    }
+                    return output.map(Some);
+                }
+                Err(TryRecvError::Empty) => return Ok(None),
+                Err(TryRecvError::Disconnected) => {
+                    // any frames that weren't output were lost to an error
+                    self.frames_in_flight -= chunk.frames;
+                    self.pending.pop_front();
+                }
+            }
+        }
+        Ok(None)
+    }
+}
+
+// Encodes the chunk and sends its outputs, stopping early if the chunked encoder is dropped.
+fn encode_chunk<E: VideoEncoder>(
+    new_encoder: &dyn Fn() -> Result<E, E::Error>,
+    cancelled: &AtomicBool,
+    frames: Vec<(E::RawVideoFrame, EncodedFrameType)>,
+    outputs: mpsc::SyncSender<Result<VideoEncoderOutput<E::RawVideoFrame>, E::Error>>,
+) {
+    if cancelled.load(Ordering::Relaxed) {
+        return;
+    }
+    let mut encoder = match new_encoder() {
+        Ok(encoder) => encoder,
+        Err(e) => {
+            let _ = outputs.send(Err(e));
+            return;
+        }
+    };
+    for (frame, frame_type) in frames {
+        // encoders with lookahead may not produce any output for a whole chunk, so the outputs
+        // being disconnected can't be relied on to stop them
+        if cancelled.load(Ordering::Relaxed) {
+            return;
+        }
+        match encoder.encode(frame, frame_type) {
+            Ok(None) => {}
+            // if the receiver is gone, nobody wants the rest of the chunk
+            Ok(Some(output)) => {
+                if outputs.send(Ok(output)).is_err() {
+                    return;
+                }
+            }
+            Err(e) => {
+                let _ = outputs.send(Err(e));
+                return;
+            }
+        }
+    }
+    while !cancelled.load(Ordering::Relaxed) {
+        match encoder.flush() {
+            Ok(None) => return,
+            Ok(Some(output)) => {
+                if outputs.send(Ok(output)).is_err() {
+                    return;
+                }
+            }
+            Err(e) => {
+                let _ = outputs.send(Err(e));
+                return;
+            }
+        }
+    }
+}
+
+impl<E> VideoEncoder for ChunkedEncoder<E>
+where
+    E: VideoEncoder + 'static,
+    E::RawVideoFrame: Send + 'static,
+    E::Error: Send + 'static,
+{
+    type Error = E::Error;
+    type RawVideoFrame = E::RawVideoFrame;
+
+    fn encode(&mut self, frame: E::RawVideoFrame, frame_type: EncodedFrameType) -> Result<Option<VideoEncoderOutput<E::RawVideoFrame>>, E::Error> {
+        let frame_type = if self.chunk.is_empty() { EncodedFrameType::Key } else { frame_type };
+        self.chunk.push((frame, frame_type));
+        self.frames_in_flight += 1;
+        if self.chunk.len() == self.config.chunk_frames {
+            self.send_chunk();
+        }
+        let block = self.frames_in_flight > 2 * self.config.workers * self.config.chunk_frames;
+        self.next_output(block)
+    }
+
+    fn flush(&mut self) -> Result<Option<VideoEncoderOutput<E::RawVideoFrame>>, E::Error> {
+        self.send_chunk();
+        self.next_output(true)
+    }
+}
+
+impl<E: VideoEncoder> Drop for ChunkedEncoder<E> {
+    fn drop(&mut self) {
+        // workers abandon whatever they're encoding before the next frame, skip any chunks that
+        // are still queued, then stop once the chunks are gone
+        self.cancelled.store(true, Ordering::Relaxed);
+        self.chunks = None;
+        self.pending.clear();
+        for worker in self.workers.drain(..) {
+            let _ = worker.join();
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use crate::{X264Encoder, X264EncoderConfig, X264EncoderInputFormat};
+    use av_traits::{EncodedVideoFrame, RawVideoFrame};
+    use std::{sync::atomic::AtomicUsize, time::Duration};
+
+    // An encoder that delays its output by a few frames, like one with lookahead would.
+    struct TestEncoder {
+        delayed: VecDeque<(u32, EncodedFrameType)>,
+    }
+
+    impl VideoEncoder for TestEncoder {
+        type Error = ();
+        type RawVideoFrame = u32;
+
+        fn encode(&mut self, frame: u32, frame_type: EncodedFrameType) -> Result<Option<VideoEncoderOutput<u32>>, ()> {
+            if frame == 1000 {
+                return Err(());
+            }
+            self.delayed.push_back((frame, frame_type));
+            if self.delayed.len() > 3 {
+                self.flush()
+            } else {
+                Ok(None)
+            }
+        }
+
+        fn flush(&mut self) -> Result<Option<VideoEncoderOutput<u32>>, ()> {
+            Ok(self.delayed.pop_front().map(|(frame, frame_type)| VideoEncoderOutput {
+                raw_frame: frame,
+                encoded_frame: Some(EncodedVideoFrame {
+                    data: frame.to_be_bytes().to_vec(),
+                    is_keyframe: frame_type == EncodedFrameType::Key,
+                }),
+            }))
+        }
+    }
+
+    fn new_encoder(workers: usize) -> ChunkedEncoder<TestEncoder> {
+        ChunkedEncoder::new(ChunkedEncoderConfig { chunk_frames: 10, workers }, || {
+            Ok(TestEncoder { delayed: VecDeque::new() })
+        })
+        .unwrap()
+    }
+
+    #[test]
+    fn test_chunked_encoder() {
+        for workers in 1..=4 {
+            let mut encoder = new_encoder(workers);
+            let mut outputs = vec![];
+            for frame in 0..95 {
+                let frame_type = if frame == 42 { EncodedFrameType::Key } else { EncodedFrameType::Auto };
+                if let Some(output) = encoder.encode(frame, frame_type).unwrap() {
+                    outputs.push(output);
+                }
+                assert!(encoder.frames_in_flight <= 2 * workers * 10);
+            }
+            while let Some(output) = encoder.flush().unwrap() {
+                outputs.push(output);
+            }
+
+            assert_eq!(outputs.iter().map(|output| output.raw_frame).collect::<Vec<_>>(), (0..95).collect::<Vec<_>>());
+            for output in outputs {
+                let encoded_frame = output.encoded_frame.unwrap();
+                assert_eq!(encoded_frame.data, output.raw_frame.to_be_bytes());
+                assert_eq!(encoded_frame.is_keyframe, output.raw_frame % 10 == 0 || output.raw_frame == 42);
+            }
+        }
+    }
+
+    #[test]
+    fn test_chunked_x264_encoder() {
+        struct TestFrame {
+            index: usize,
+            samples: Vec<Vec<u8>>,
+        }
+
+        impl RawVideoFrame<u8> for TestFrame {
+            fn samples(&self, plane: usize) -> &[u8] {
+                &self.samples[plane]
+            }
+        }
+
+        let mut encoder = ChunkedEncoder::new(ChunkedEncoderConfig { chunk_frames: 10, workers: 3 }, || {
+            X264Encoder::with_threads(
+                X264EncoderConfig {
+                    width: 640,
+                    height: 360,
+                    bitrate: Some(2000),
+                    fps: 30.0,
+                    input_format: X264EncoderInputFormat::Yuv420Planar,
+                },
+                1,
+            )
+        })
+        .unwrap();
+
+        let mut outputs = vec![];
+        for index in 0..45 {
+            let mut y = Vec::with_capacity(640 * 360);
+            for line in 0..360 {
+                // add some motion by drawing a line that moves from top to bottom
+                y.resize(y.len() + 640, if line / 8 == index { 16 } else { 128 });
+            }
+            let frame = TestFrame {
+                index,
+                samples: vec![y, vec![128; 640 * 360 / 4], vec![128; 640 * 360 / 4]],
+            };
+            outputs.extend(encoder.encode(frame, EncodedFrameType::Auto).unwrap());
+        }
+        while let Some(output) = encoder.flush().unwrap() {
+            outputs.push(output);
+        }
+
+        assert_eq!(
+            outputs.iter().map(|output| output.raw_frame.index).collect::<Vec<_>>(),
+            (0..45).collect::<Vec<_>>()
+        );
+        for output in outputs {
+            let encoded_frame = output.encoded_frame.expect("frame was not dropped");
+            if output.raw_frame.index % 10 == 0 {
+                assert!(encoded_frame.is_keyframe, "frame {} should be a keyframe", output.raw_frame.index);
+            }
+        }
+    }
+
+    #[test]
+    fn test_chunked_encoder_invalid_config() {
+        for (chunk_frames, workers) in [(0, 1), (1, 0)] {
+            let result = ChunkedEncoder::new(ChunkedEncoderConfig { chunk_frames, workers }, || Ok(TestEncoder { delayed: VecDeque::new() }));
+            assert_eq!(result.err().map(|e| e.kind()), Some(io::ErrorKind::InvalidInput));
+        }
+    }
+
+    #[test]
+    fn test_chunked_encoder_error() {
+        let mut encoder = new_encoder(2);
+        let mut frames = vec![];
+        let mut errors = 0;
+        for frame in (0..20).chain([1000]).chain(21..40) {
+            match encoder.encode(frame, EncodedFrameType::Auto) {
+                Ok(Some(output)) => frames.push(output.raw_frame),
+                Ok(None) => {}
+                Err(()) => errors += 1,
+            }
+        }
+        loop {
+            match encoder.flush() {
+                Ok(Some(output)) => frames.push(output.raw_frame),
+                Ok(None) => break,
+                Err(()) => errors += 1,
+            }
+        }
+
+        // the chunk with the failed frame is lost, but the others are unaffected
+        assert_eq!(errors, 1);
+        assert_eq!(frames, (0..20).chain(30..40).collect::<Vec<_>>());
+        assert_eq!(encoder.frames_in_flight, 0);
+    }
+
+    #[test]
+    fn test_chunked_encoder_drop() {
+        // An encoder that takes a while for each frame and, like x264 with lookahead, holds all of
+        // its output until it's flushed.
+        struct SlowEncoder {
+            encoded: Arc<AtomicUsize>,
+            delayed: VecDeque<u32>,
+        }
+
+        impl VideoEncoder for SlowEncoder {
+            type Error = ();
+            type RawVideoFrame = u32;
+
+            fn encode(&mut self, frame: u32, _frame_type: EncodedFrameType) -> Result<Option<VideoEncoderOutput<u32>>, ()> {
+                thread::sleep(Duration::from_millis(5));
+                self.encoded.fetch_add(1, Ordering::Relaxed);
+                self.delayed.push_back(frame);
+                Ok(None)
+            }
+
+            fn flush(&mut self) -> Result<Option<VideoEncoderOutput<u32>>, ()> {
+                Ok(self.delayed.pop_front().map(|frame| VideoEncoderOutput {
+                    raw_frame: frame,
+                    encoded_frame: None,
+                }))
+            }
+        }
+
+        let encoders = Arc::new(AtomicUsize::new(0));
+        let encoded = Arc::new(AtomicUsize::new(0));
+        let mut encoder = ChunkedEncoder::new(ChunkedEncoderConfig { chunk_frames: 10, workers: 1 }, {
+            let encoders = encoders.clone();
+            let encoded = encoded.clone();
+            move || {
+                encoders.fetch_add(1, Ordering::Relaxed);
+                Ok(SlowEncoder {
+                    encoded: encoded.clone(),
+                    delayed: VecDeque::new(),
+                })
+            }
+        })
+        .unwrap();
+
+        // one chunk is being encoded and the other is queued when the encoder is dropped
+        for frame in 0..20 {
+            assert!(encoder.encode(frame, EncodedFrameType::Auto).unwrap().is_none());
+        }
+        drop(encoder);
+
+        assert!(encoders.load(Ordering::Relaxed) <= 1);
+        assert!(encoded.load(Ordering::Relaxed) < 10);
+    }
+}
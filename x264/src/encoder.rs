@@ -55,6 +55,16 @@ pub struct X264EncoderConfig {
 
 impl<F> X264Encoder<F> {
     pub fn new(config: X264EncoderConfig) -> Result<Self> {
+        Self::open(config, None)
+    }
+
+    /// Like `new`, but x264 encodes with the given number of threads instead of choosing based on
+    /// the number of CPUs.
+    pub fn with_threads(config: X264EncoderConfig, threads: u32) -> Result<Self> {
+        Self::open(config, Some(threads))
+    }
+
+    fn open(config: X264EncoderConfig, threads: Option<u32>) -> Result<Self> {
         unsafe {
             let mut params: mem::MaybeUninit<sys::x264_param_t> = mem::MaybeUninit::uninit();
             sys::x264_param_default(params.as_mut_ptr());
@@ -77,6 +87,10 @@ impl<F> X264Encoder<F> {
             params.i_timebase_num = params.i_fps_den;
             params.i_timebase_den = params.i_fps_num;
 
+            if let Some(threads) = threads {
+                params.i_threads = threads as _;
+            }
+
             if let Some(bitrate) = config.bitrate {
                 params.rc.i_bitrate = (bitrate / 1000) as _;
                 params.rc.i_rc_method = sys::X264_RC_ABR as _;
@@ -1,2 +1,5 @@
+mod chunked_encoder;
+pub use chunked_encoder::*;
+
 mod encoder;
 pub use encoder::*;